@@ -0,0 +1,117 @@
+// Nanoseconds per in-node key search at several fanouts: the SIMD kernels against the linear scan
+// the B+ tree used to do and std::upper_bound.
+// Usage: key_search_bench [searches]
+#include "key_search.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// Enough nodes that the keys do not all sit in L1, as on a real descent
+constexpr std::size_t BENCH_NODES = 512;
+
+struct Query
+{
+    std::size_t node;
+    float key;
+};
+
+// Original descent loop: first key greater than key
+std::size_t linearUpperBound(const float *keys, std::size_t count, float key)
+{
+    std::size_t i = 0;
+    while (i < count && key >= keys[i])
+        i++;
+    return i;
+}
+
+template <typename Search>
+double nanosPerSearch(const std::vector<float> &keys, std::size_t fanout, const std::vector<Query> &queries,
+                      Search search, std::vector<std::size_t> &results)
+{
+    results.resize(queries.size());
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t q = 0; q < queries.size(); q++)
+        results[q] = search(keys.data() + queries[q].node * fanout, fanout, queries[q].key);
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / static_cast<double>(queries.size());
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::size_t searches = argc > 1 ? std::stoul(argv[1]) : 2000000;
+
+    std::vector<KeySearchKernel> kernels;
+    for (KeySearchKernel kernel :
+         {KeySearchKernel::SCALAR, KeySearchKernel::SSE2, KeySearchKernel::AVX2, KeySearchKernel::AVX512})
+    {
+        // Unsupported kernels fall back to the detected one; only time those that really run
+        if (kernel == KeySearchKernel::SCALAR || kernel <= detectKeySearchKernel())
+            kernels.push_back(kernel);
+    }
+
+    std::cout << "Searches: " << searches << " per method, detected kernel: "
+              << keySearchKernelName(detectKeySearchKernel()) << std::endl;
+    std::cout << "Nanoseconds per search:" << std::endl;
+    std::printf("%6s %10s %12s", "keys", "linear", "upper_bound");
+    for (KeySearchKernel kernel : kernels)
+        std::printf(" %9s", keySearchKernelName(kernel));
+    std::printf("\n");
+
+    std::mt19937 rng(42);
+    bool identical = true;
+    for (std::size_t fanout : {8, 16, 32, 64, 128, 256, 290, 507})
+    {
+        // Sorted keys with duplicates, as in a leaf of FT_PCT_home values
+        std::vector<float> keys(BENCH_NODES * fanout);
+        std::uniform_int_distribution<int> value(0, 1000);
+        for (std::size_t node = 0; node < BENCH_NODES; node++)
+        {
+            float *begin = keys.data() + node * fanout;
+            for (std::size_t i = 0; i < fanout; i++)
+                begin[i] = static_cast<float>(value(rng)) / 1000.0f;
+            std::sort(begin, begin + fanout);
+        }
+
+        std::vector<Query> queries(searches);
+        std::uniform_int_distribution<std::size_t> node_of(0, BENCH_NODES - 1);
+        for (auto &query : queries)
+            query = {node_of(rng), static_cast<float>(value(rng)) / 1000.0f};
+
+        std::vector<std::size_t> expected;
+        std::vector<std::size_t> results;
+        double linear = nanosPerSearch(keys, fanout, queries, linearUpperBound, expected);
+        double upper = nanosPerSearch(
+            keys, fanout, queries,
+            [](const float *k, std::size_t count, float key) {
+                return static_cast<std::size_t>(std::upper_bound(k, k + count, key) - k);
+            },
+            results);
+        identical = identical && results == expected;
+
+        std::printf("%6zu %10.1f %12.1f", fanout, linear, upper);
+        for (KeySearchKernel kernel : kernels)
+        {
+            double nanos = nanosPerSearch(
+                keys, fanout, queries,
+                [kernel](const float *k, std::size_t count, float key) {
+                    return countKeysAtMost(k, count, key, kernel);
+                },
+                results);
+            identical = identical && results == expected;
+            std::printf(" %9.1f", nanos);
+        }
+        std::printf("\n");
+    }
+
+    std::cout << "Results identical: " << (identical ? "yes" : "NO") << std::endl;
+    return identical ? 0 : 1;
+}
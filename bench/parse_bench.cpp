@@ -0,0 +1,146 @@
+// Rows/second of the games.txt parser against the original stringstream implementation.
+// Usage: parse_bench [data/games.txt] [repeat]
+#include "constants.h"
+#include "record.h"
+#include "tsv_parser.h"
+#include "utils.h"
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// Copy of the parser this benchmark is measured against
+std::uint16_t legacyDateToInt(const std::string &s)
+{
+    std::stringstream ss(s);
+    std::string day_str, month_str, year_str;
+
+    std::getline(ss, day_str, '/');
+    std::getline(ss, month_str, '/');
+    std::getline(ss, year_str);
+
+    int day{std::stoi(day_str)};
+    int month{std::stoi(month_str)};
+    int year{std::stoi(year_str)};
+
+    int ttlDays{};
+    for (int y{(int)EPOCH_YEAR}; y < year; y++)
+        ttlDays += isLeapYear(y) ? 366 : 365;
+
+    int daysInMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (isLeapYear(year))
+        daysInMonth[1] = 29;
+
+    for (int m = 0; m < month - 1; m++)
+        ttlDays += daysInMonth[m];
+
+    ttlDays += day;
+    return static_cast<std::uint16_t>(ttlDays);
+}
+
+Record legacyParse(const std::string &data)
+{
+    Record rec;
+    std::stringstream ss(data);
+    std::string token;
+
+    std::getline(ss, token, '\t');
+    rec.game_date_est = legacyDateToInt(token);
+    std::getline(ss, token, '\t');
+    rec.team_ID_home = token.empty() ? 0 : std::stoul(token);
+    std::getline(ss, token, '\t');
+    rec.pts_home = static_cast<std::uint8_t>(token.empty() ? 0 : std::stoul(token));
+    std::getline(ss, token, '\t');
+    rec.fg_pct_home = token.empty() ? 0.0f : std::stof(token);
+    std::getline(ss, token, '\t');
+    rec.ft_pct_home = token.empty() ? 0.0f : std::stof(token);
+    std::getline(ss, token, '\t');
+    rec.fg3_pct_home = token.empty() ? 0.0f : std::stof(token);
+    std::getline(ss, token, '\t');
+    rec.ast_home = static_cast<std::uint8_t>(token.empty() ? 0 : std::stoul(token));
+    std::getline(ss, token, '\t');
+    rec.reb_home = static_cast<std::uint8_t>(token.empty() ? 0 : std::stoul(token));
+    std::getline(ss, token, '\t');
+    rec.home_team_wins = static_cast<std::uint8_t>(token.empty() ? 0 : std::stoul(token));
+
+    return rec;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string path = argc > 1 ? argv[1] : std::string(DATA_FILE);
+    int repeat = argc > 2 ? std::stoi(argv[2]) : 20;
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Cannot open file: " << path << '\n';
+        return 1;
+    }
+
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::string body = text.substr(text.find('\n') + 1); // drop header
+
+    std::string input;
+    input.reserve(body.size() * repeat);
+    for (int i = 0; i < repeat; i++)
+        input += body;
+
+    std::cout << "Input: " << input.size() / (1024 * 1024) << " MiB (" << repeat << " copies of " << path << ")"
+              << std::endl;
+
+    // Original path: getline per line, stringstream per line and per date
+    std::vector<Record> legacy;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::istringstream stream(input);
+        std::string line;
+        while (std::getline(stream, line))
+            legacy.push_back(legacyParse(line));
+    }
+    double legacy_seconds = secondsSince(start);
+
+    // New path: memchr over the buffer, from_chars per field
+    std::vector<Record> fast;
+    fast.reserve(legacy.size());
+    start = std::chrono::steady_clock::now();
+    {
+        const char *pos = input.data();
+        const char *end = pos + input.size();
+        while (pos < end)
+        {
+            const char *newline = static_cast<const char *>(std::memchr(pos, '\n', end - pos));
+            if (!newline)
+                newline = end;
+            fast.push_back(parseGameRow(std::string_view(pos, newline - pos)));
+            pos = newline + 1;
+        }
+    }
+    double fast_seconds = secondsSince(start);
+
+    bool identical = legacy.size() == fast.size() &&
+                     std::memcmp(legacy.data(), fast.data(), legacy.size() * sizeof(Record)) == 0;
+
+    std::cout << "Rows: " << legacy.size() << std::endl;
+    std::cout << "stringstream parser: " << legacy.size() / legacy_seconds << " rows/s (" << legacy_seconds * 1000
+              << " ms)" << std::endl;
+    std::cout << "from_chars parser:   " << fast.size() / fast_seconds << " rows/s (" << fast_seconds * 1000
+              << " ms)" << std::endl;
+    std::cout << "Speedup: " << legacy_seconds / fast_seconds << "x" << std::endl;
+    std::cout << "Records identical: " << (identical ? "yes" : "NO") << std::endl;
+
+    return identical ? 0 : 1;
+}
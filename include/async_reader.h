@@ -0,0 +1,44 @@
+#pragma once
+
+#include "block.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class IoUring;
+
+// Reads whole blocks of a file keeping up to queue_depth reads in flight. Uses io_uring
+// when the kernel allows it and falls back to a thread pool issuing pread otherwise.
+class AsyncBlockReader
+{
+  public:
+    // Invoked on the calling thread, in completion order rather than request order
+    using Callback = std::function<void(std::uint32_t block_id, const Block &block)>;
+
+  private:
+    std::string filename;
+    unsigned queueDepth;
+    int fd;
+    std::unique_ptr<IoUring> ring;
+
+    std::size_t readWithIoUring(const std::vector<std::uint32_t> &block_ids, const Callback &on_block);
+    std::size_t readWithThreads(const std::vector<std::uint32_t> &block_ids, const Callback &on_block);
+
+  public:
+    AsyncBlockReader(const std::string &filename, unsigned queue_depth = 32);
+    ~AsyncBlockReader();
+
+    AsyncBlockReader(const AsyncBlockReader &) = delete;
+    AsyncBlockReader &operator=(const AsyncBlockReader &) = delete;
+
+    // Returns the number of blocks delivered; blocks that fail to read are reported and skipped
+    std::size_t readBlocks(const std::vector<std::uint32_t> &block_ids, const Callback &on_block);
+
+    bool usingIoUring() const
+    {
+        return ring != nullptr;
+    }
+};
@@ -1,7 +1,8 @@
 #pragma once
 #include "constants.h"
 #include <cstring>
-struct Block
+// Cache-line aligned so a cached page can be used in place as a B+ tree node
+struct alignas(64) Block
 {
     char data[BLOCK_SIZE];
 
@@ -0,0 +1,372 @@
+#pragma once
+
+#include "constants.h"
+#include "key_search.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Record reference for indexing
+struct RecordRef
+{
+    std::uint32_t block_id;
+    std::uint16_t record_offset;
+
+    RecordRef() : block_id(0), record_offset(0)
+    {
+    }
+    RecordRef(std::uint32_t bid, std::uint16_t offset) : block_id(bid), record_offset(offset)
+    {
+    }
+
+    bool operator<(const RecordRef &other) const
+    {
+        if (block_id != other.block_id)
+            return block_id < other.block_id;
+        return record_offset < other.record_offset;
+    }
+
+    bool operator==(const RecordRef &other) const
+    {
+        return block_id == other.block_id && record_offset == other.record_offset;
+    }
+};
+
+// Every B+ tree node is one BLOCK_SIZE page, and its id is its page number in the index file:
+//   [NodeHeader, 32 bytes][key array]...
+// INTERNAL: key_count keys, then key_count + 1 child ids at INTERNAL_CHILDREN_OFFSET.
+// LEAF:     key_count keys, one LeafSlot per key at LEAF_SLOTS_OFFSET, and the RID area at
+//           LEAF_RIDS_OFFSET. Each key's records form a run of the RID area; runs are packed in key
+//           order, so slot i starts where slot i - 1 ends. A run longer than INLINE_RUN_LIMIT moves to
+//           a chain of OVERFLOW pages and keeps a single RID item whose block_id is the chain's head.
+// OVERFLOW: rid_count RIDs right after the header; next links the chain.
+// FREE_LIST: a free page lent to the index file's free-page list: key_count more free page ids right
+//           after the header; next links the chain. Only written by a save, never part of the tree.
+
+enum class NodeType : std::uint8_t
+{
+    FREE = 0, // a zero page: never used, or freed
+    INTERNAL = 1,
+    LEAF = 2,
+    OVERFLOW = 3,
+    FREE_LIST = 4
+};
+
+#pragma pack(push, 1)
+struct NodeHeader
+{
+    NodeType type;
+    std::uint8_t is_root;
+    std::uint16_t key_count;
+    std::uint16_t rid_count; // RID items used: a leaf's RID area, or an overflow page
+    std::uint16_t reserved;
+    std::uint32_t node_id;
+    std::uint32_t unused;    // once the parent id; splits find parents on the descent path instead
+    std::uint32_t next; // next leaf, or next overflow page; 0 ends the list
+    std::uint8_t padding[12];
+};
+
+struct LeafSlot
+{
+    std::uint16_t offset; // first RID item of the run
+    std::uint16_t count;  // RID items in the run, or OVERFLOW_RUN
+};
+#pragma pack(pop)
+
+// Header padded so the key array starts 32-byte aligned
+inline constexpr std::size_t NODE_HEADER_SIZE = 32;
+// block_id + record_offset, packed
+inline constexpr std::size_t PACKED_REF_SIZE = sizeof(std::uint32_t) + sizeof(std::uint16_t);
+
+inline constexpr std::size_t INTERNAL_MAX_KEYS =
+    (BLOCK_SIZE - NODE_HEADER_SIZE - sizeof(std::uint32_t)) / (sizeof(float) + sizeof(std::uint32_t));
+inline constexpr std::size_t INTERNAL_CHILDREN_OFFSET = NODE_HEADER_SIZE + INTERNAL_MAX_KEYS * sizeof(float);
+
+// A leaf is sized for one RID per key; heavier duplicates go to overflow pages
+inline constexpr std::size_t LEAF_MAX_KEYS =
+    (BLOCK_SIZE - NODE_HEADER_SIZE) / (sizeof(float) + sizeof(LeafSlot) + PACKED_REF_SIZE);
+inline constexpr std::size_t LEAF_SLOTS_OFFSET = NODE_HEADER_SIZE + LEAF_MAX_KEYS * sizeof(float);
+inline constexpr std::size_t LEAF_RIDS_OFFSET = LEAF_SLOTS_OFFSET + LEAF_MAX_KEYS * sizeof(LeafSlot);
+inline constexpr std::size_t LEAF_RID_CAPACITY = (BLOCK_SIZE - LEAF_RIDS_OFFSET) / PACKED_REF_SIZE;
+
+// Runs longer than this live in overflow pages, so no single key can fill a leaf
+inline constexpr std::size_t INLINE_RUN_LIMIT = LEAF_RID_CAPACITY / 4;
+inline constexpr std::uint16_t OVERFLOW_RUN = 0xFFFF;
+
+inline constexpr std::size_t OVERFLOW_RIDS_OFFSET = NODE_HEADER_SIZE;
+inline constexpr std::size_t OVERFLOW_RID_CAPACITY = (BLOCK_SIZE - OVERFLOW_RIDS_OFFSET) / PACKED_REF_SIZE;
+
+inline constexpr std::size_t FREE_LIST_IDS_OFFSET = NODE_HEADER_SIZE;
+inline constexpr std::size_t FREE_LIST_CAPACITY = (BLOCK_SIZE - FREE_LIST_IDS_OFFSET) / sizeof(std::uint32_t);
+
+static_assert(sizeof(NodeHeader) == NODE_HEADER_SIZE, "NodeHeader must match NODE_HEADER_SIZE");
+static_assert(INTERNAL_CHILDREN_OFFSET + (INTERNAL_MAX_KEYS + 1) * sizeof(std::uint32_t) <= BLOCK_SIZE,
+              "internal node overflows a page");
+static_assert(LEAF_RIDS_OFFSET + LEAF_RID_CAPACITY * PACKED_REF_SIZE <= BLOCK_SIZE, "leaf node overflows a page");
+static_assert(LEAF_RID_CAPACITY < OVERFLOW_RUN, "RID item counts must fit a LeafSlot");
+
+struct alignas(64) BPlusNode
+{
+    char data[BLOCK_SIZE];
+
+    void init(NodeType type, std::uint32_t node_id)
+    {
+        std::memset(data, 0, BLOCK_SIZE);
+        header()->type = type;
+        header()->node_id = node_id;
+    }
+
+    NodeHeader *header()
+    {
+        return reinterpret_cast<NodeHeader *>(data);
+    }
+    const NodeHeader *header() const
+    {
+        return reinterpret_cast<const NodeHeader *>(data);
+    }
+
+    bool isLeaf() const
+    {
+        return header()->type == NodeType::LEAF;
+    }
+    // A page the tree does not use, including one that carries part of the free-page list
+    bool isFree() const
+    {
+        return header()->type == NodeType::FREE || header()->type == NodeType::FREE_LIST;
+    }
+    std::size_t keyCount() const
+    {
+        return header()->key_count;
+    }
+
+    float *keys()
+    {
+        return reinterpret_cast<float *>(data + NODE_HEADER_SIZE);
+    }
+    const float *keys() const
+    {
+        return reinterpret_cast<const float *>(data + NODE_HEADER_SIZE);
+    }
+
+    std::uint32_t *children()
+    {
+        return reinterpret_cast<std::uint32_t *>(data + INTERNAL_CHILDREN_OFFSET);
+    }
+    const std::uint32_t *children() const
+    {
+        return reinterpret_cast<const std::uint32_t *>(data + INTERNAL_CHILDREN_OFFSET);
+    }
+
+    LeafSlot *slots()
+    {
+        return reinterpret_cast<LeafSlot *>(data + LEAF_SLOTS_OFFSET);
+    }
+    const LeafSlot *slots() const
+    {
+        return reinterpret_cast<const LeafSlot *>(data + LEAF_SLOTS_OFFSET);
+    }
+
+    // Position of the first key >= key / > key, found with the SIMD kernel for this CPU
+    std::size_t lowerBound(float key) const
+    {
+        return countKeysBelow(keys(), keyCount(), key);
+    }
+    std::size_t upperBound(float key) const
+    {
+        return countKeysAtMost(keys(), keyCount(), key);
+    }
+
+    // RID item i of a leaf's RID area, or of an overflow page
+    RecordRef rid(std::size_t i) const
+    {
+        const char *at = data + ridsOffset() + i * PACKED_REF_SIZE;
+        RecordRef ref;
+        std::memcpy(&ref.block_id, at, sizeof(ref.block_id));
+        std::memcpy(&ref.record_offset, at + sizeof(ref.block_id), sizeof(ref.record_offset));
+        return ref;
+    }
+    void setRid(std::size_t i, const RecordRef &ref)
+    {
+        char *at = data + ridsOffset() + i * PACKED_REF_SIZE;
+        std::memcpy(at, &ref.block_id, sizeof(ref.block_id));
+        std::memcpy(at + sizeof(ref.block_id), &ref.record_offset, sizeof(ref.record_offset));
+    }
+
+    std::size_t ridCapacity() const
+    {
+        return isLeaf() ? LEAF_RID_CAPACITY : OVERFLOW_RID_CAPACITY;
+    }
+    std::size_t freeRids() const
+    {
+        return ridCapacity() - header()->rid_count;
+    }
+
+    // Leaf runs
+
+    bool isOverflowRun(std::size_t pos) const
+    {
+        return slots()[pos].count == OVERFLOW_RUN;
+    }
+    // RID items run pos takes up in the RID area
+    std::size_t runItems(std::size_t pos) const
+    {
+        return isOverflowRun(pos) ? 1 : slots()[pos].count;
+    }
+    std::uint32_t overflowHead(std::size_t pos) const
+    {
+        return rid(slots()[pos].offset).block_id;
+    }
+    void setOverflowHead(std::size_t pos, std::uint32_t head)
+    {
+        setRid(slots()[pos].offset, RecordRef(head, 0));
+    }
+
+    // New key at pos with an empty inline run; the caller checks there is room
+    void leafInsertKey(std::size_t pos, float key)
+    {
+        NodeHeader *h = header();
+        std::memmove(keys() + pos + 1, keys() + pos, (h->key_count - pos) * sizeof(float));
+        std::memmove(slots() + pos + 1, slots() + pos, (h->key_count - pos) * sizeof(LeafSlot));
+        keys()[pos] = key;
+        slots()[pos].offset = pos < h->key_count ? slots()[pos + 1].offset : h->rid_count;
+        slots()[pos].count = 0;
+        h->key_count++;
+    }
+
+    // Appends ref to the inline run at pos, shifting the runs behind it
+    void leafAddRid(std::size_t pos, const RecordRef &ref)
+    {
+        std::size_t at = slots()[pos].offset + slots()[pos].count;
+        shiftRids(at, 1);
+        setRid(at, ref);
+        slots()[pos].count++;
+        rebaseSlots(pos + 1, 1);
+    }
+
+    // Drops RID item i of the inline run at pos
+    void leafRemoveRid(std::size_t pos, std::size_t i)
+    {
+        shiftRids(slots()[pos].offset + i + 1, -1);
+        slots()[pos].count--;
+        rebaseSlots(pos + 1, -1);
+    }
+
+    // Drops the key at pos together with its run
+    void leafRemoveKey(std::size_t pos)
+    {
+        NodeHeader *h = header();
+        std::size_t items = runItems(pos);
+        shiftRids(slots()[pos].offset + items, -static_cast<long>(items));
+        std::memmove(keys() + pos, keys() + pos + 1, (h->key_count - pos - 1) * sizeof(float));
+        std::memmove(slots() + pos, slots() + pos + 1, (h->key_count - pos - 1) * sizeof(LeafSlot));
+        h->key_count--;
+        rebaseSlots(pos, -static_cast<long>(items));
+    }
+
+    // Replaces the inline run at pos by a single item pointing at an overflow chain
+    void leafMakeOverflowRun(std::size_t pos, std::uint32_t head)
+    {
+        long items = slots()[pos].count;
+        shiftRids(slots()[pos].offset + items, 1 - items);
+        slots()[pos].count = OVERFLOW_RUN;
+        setOverflowHead(pos, head);
+        rebaseSlots(pos + 1, 1 - items);
+    }
+
+    // Keeps the first keep keys and their runs
+    void leafTruncate(std::size_t keep)
+    {
+        NodeHeader *h = header();
+        if (keep < h->key_count)
+            h->rid_count = slots()[keep].offset;
+        h->key_count = static_cast<std::uint16_t>(keep);
+    }
+
+    // Appends the runs [from, to) of src behind the last run; the caller checks there is room
+    void leafAppendRuns(const BPlusNode &src, std::size_t from, std::size_t to)
+    {
+        NodeHeader *h = header();
+        if (from == to)
+            return;
+
+        std::size_t first = src.slots()[from].offset;
+        std::size_t items = (to < src.keyCount() ? src.slots()[to].offset : src.header()->rid_count) - first;
+        std::memcpy(keys() + h->key_count, src.keys() + from, (to - from) * sizeof(float));
+        std::memcpy(data + LEAF_RIDS_OFFSET + h->rid_count * PACKED_REF_SIZE,
+                    src.data + LEAF_RIDS_OFFSET + first * PACKED_REF_SIZE, items * PACKED_REF_SIZE);
+        for (std::size_t i = from; i < to; i++)
+        {
+            LeafSlot &slot = slots()[h->key_count++];
+            slot.offset = static_cast<std::uint16_t>(src.slots()[i].offset - first + h->rid_count);
+            slot.count = src.slots()[i].count;
+        }
+        h->rid_count = static_cast<std::uint16_t>(h->rid_count + items);
+    }
+
+    // Bulk loading: a new last key, then RIDs for it
+    void leafAppendKey(float key)
+    {
+        NodeHeader *h = header();
+        keys()[h->key_count] = key;
+        slots()[h->key_count].offset = h->rid_count;
+        slots()[h->key_count].count = 0;
+        h->key_count++;
+    }
+    void leafAppendRid(const RecordRef &ref)
+    {
+        setRid(header()->rid_count++, ref);
+        slots()[header()->key_count - 1].count++;
+    }
+    void leafAppendOverflowRun(float key, std::uint32_t head)
+    {
+        leafAppendKey(key);
+        slots()[header()->key_count - 1].count = OVERFLOW_RUN;
+        setRid(header()->rid_count++, RecordRef(head, 0));
+    }
+
+    // Free-list pages
+
+    std::uint32_t *freeIds()
+    {
+        return reinterpret_cast<std::uint32_t *>(data + FREE_LIST_IDS_OFFSET);
+    }
+    const std::uint32_t *freeIds() const
+    {
+        return reinterpret_cast<const std::uint32_t *>(data + FREE_LIST_IDS_OFFSET);
+    }
+
+    // Overflow pages
+
+    void overflowAppend(const RecordRef &ref)
+    {
+        setRid(header()->rid_count++, ref);
+    }
+    void overflowRemove(std::size_t i)
+    {
+        shiftRids(i + 1, -1);
+    }
+
+  private:
+    std::size_t ridsOffset() const
+    {
+        return isLeaf() ? LEAF_RIDS_OFFSET : OVERFLOW_RIDS_OFFSET;
+    }
+
+    // Moves RID items [from, rid_count) by delta places and adjusts rid_count
+    void shiftRids(std::size_t from, long delta)
+    {
+        NodeHeader *h = header();
+        char *base = data + ridsOffset();
+        std::memmove(base + (from + delta) * PACKED_REF_SIZE, base + from * PACKED_REF_SIZE,
+                     (h->rid_count - from) * PACKED_REF_SIZE);
+        h->rid_count = static_cast<std::uint16_t>(h->rid_count + delta);
+    }
+
+    void rebaseSlots(std::size_t from, long delta)
+    {
+        for (std::size_t i = from; i < keyCount(); i++)
+            slots()[i].offset = static_cast<std::uint16_t>(slots()[i].offset + delta);
+    }
+};
+
+static_assert(sizeof(BPlusNode) == BLOCK_SIZE, "a B+ tree node is exactly one page");
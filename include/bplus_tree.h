@@ -1,108 +1,147 @@
 #pragma once
 
+#include "bplus_node.h"
+#include "buffer_pool.h"
 #include "constants.h"
+#include "node_arena.h"
 #include <algorithm>
 #include <cstdint>
 #include <fstream>
+#include <functional>
 #include <memory>
-#include <unordered_map>
+#include <string>
 #include <vector>
 
-// Record reference for indexing
-struct RecordRef
-{
-    std::uint32_t block_id;
-    std::uint16_t record_offset;
-
-    RecordRef() : block_id(0), record_offset(0)
-    {
-    }
-    RecordRef(std::uint32_t bid, std::uint16_t offset) : block_id(bid), record_offset(offset)
-    {
-    }
+// One index entry: key and the record it points at
+using IndexEntry = std::pair<float, RecordRef>;
 
-    bool operator<(const RecordRef &other) const
-    {
-        if (block_id != other.block_id)
-            return block_id < other.block_id;
-        return record_offset < other.record_offset;
-    }
+// Nodes are owned by the tree's NodeArena or its node cache; a pointer is only a view of the page
+using NodePtr = BPlusNode *;
 
-    bool operator==(const RecordRef &other) const
-    {
-        return block_id == other.block_id && record_offset == other.record_offset;
-    }
-};
+// Pages of a disk-resident index (see BPlusTree::openFromDisk) kept in memory unless told otherwise
+inline constexpr std::size_t INDEX_CACHE_NODES = 256;
+// Fewest cache frames accepted: one operation pins a root-to-leaf path plus a few pages at a time
+inline constexpr std::size_t MIN_INDEX_CACHE_NODES = 16;
 
-// B+ tree node structure
-struct BPlusNode
-{
-    bool is_leaf;
-    bool is_root;
-    std::uint32_t node_id;
-    std::vector<float> keys;
-
-    // For internal nodes: child pointers
-    std::vector<std::uint32_t> children;
-
-    // For leaf nodes: record references (handles duplicates)
-    std::vector<std::vector<RecordRef>> values;
-
-    // For leaf nodes: next leaf pointer
-    std::uint32_t next_leaf;
-
-    // Parent tracking
-    std::uint32_t parent_id;
-
-    BPlusNode(bool leaf = false) : is_leaf(leaf), is_root(false), node_id(0), next_leaf(0), parent_id(0)
-    {
-    }
-};
-
-using NodePtr = std::shared_ptr<BPlusNode>;
+class WorkStealingPool;
+class WriteAheadLog;
 
 class BPlusTree
 {
   private:
-    NodePtr root;
-    int n; // Maximum keys per node
+    std::uint32_t root_id; // 0 while the tree is empty
+    int n;          // Maximum keys per leaf
+    int internal_n; // Maximum keys per internal node
     std::uint32_t next_node_id;
+    std::vector<std::uint32_t> free_ids; // pages freed below next_node_id, reused first
     std::string index_filename;
 
     // Node storage
-    std::unordered_map<std::uint32_t, NodePtr> nodes;
+    NodeArena nodes;
+
+    // Disk-resident mode only: clean pages are faulted in through cache and stay pinned until the
+    // operation that touched them returns. A page about to change is copied into nodes first and
+    // stays there until it is written back: by saveToDisk, or once as many pages are modified as
+    // the cache holds, before the next operation starts. The file never holds half an operation.
+    std::unique_ptr<BufferPool> cache;
+    mutable std::vector<std::uint32_t> pinned;
+
+    // Mutations are appended here before they are applied, when attached
+    WriteAheadLog *wal;
 
     // Statistics
-    int total_nodes;
+    int total_nodes;    // leaves and internal nodes
+    int overflow_pages; // pages of duplicate runs moved out of their leaf
     int tree_height;
+    int write_backs; // disk-resident: saves forced by writeBackIfFull
 
     // Helper functions
-    NodePtr createNode(bool is_leaf);
-    NodePtr findLeafNode(float key);
-    NodePtr findParent(NodePtr child);
-
-    void insertIntoLeaf(NodePtr leaf, float key, const RecordRef &record_ref);
-    void insertIntoInternal(NodePtr internal, float key, std::uint32_t child_id);
-
+    NodePtr createNode(NodeType type);
+    NodePtr getNode(std::uint32_t node_id) const; // nullptr when there is no such node
+    void freeNode(NodePtr node);
+    // With path, the ids of the internal nodes passed on the way down are appended to it, root first
+    NodePtr findLeafNode(float key, std::vector<std::uint32_t> *path = nullptr);
+
+    // Copy of node that may be modified; node itself when it is already in the arena
+    NodePtr writable(NodePtr node);
+    NodePtr writableNode(std::uint32_t node_id);
+
+    // Pins taken since mark are dropped; PinScope drops an operation's pins when it returns
+    std::size_t pinMark() const
+    {
+        return pinned.size();
+    }
+    void releasePins(std::size_t mark) const;
+    struct PinScope
+    {
+        const BPlusTree &tree;
+        std::size_t mark;
+
+        explicit PinScope(const BPlusTree &tree) : tree(tree), mark(tree.pinMark())
+        {
+        }
+        ~PinScope()
+        {
+            tree.releasePins(mark);
+        }
+    };
+
+    // False when the leaf has no room for the entry and has to be split first
+    bool insertIntoLeaf(NodePtr leaf, float key, const RecordRef &record_ref);
     std::pair<NodePtr, float> splitLeafNode(NodePtr leaf);
-    std::pair<NodePtr, float> splitInternalNode(NodePtr internal);
-
-    void insertIntoParent(NodePtr left, float key, NodePtr right);
-    void updateStatistics();
-    int calculateHeight(NodePtr node);
-    void countNodes(NodePtr node, int &count);
-
-    // Disk I/O
-    void saveNodeToDisk(std::ofstream &file, NodePtr node);
-    NodePtr loadNodeFromDisk(std::ifstream &file);
+    // path holds the ancestors of left, root first; the parent is taken off its end
+    void insertIntoParent(std::vector<std::uint32_t> &path, NodePtr left, float key, NodePtr right);
+    void splitInternalNode(std::vector<std::uint32_t> &path, NodePtr internal, float key, NodePtr right);
+
+    // Duplicate runs: the overflow chain behind run pos of leaf
+    void moveRunToOverflow(BPlusNode &leaf, std::size_t pos);
+    void appendToOverflow(std::uint32_t head, const RecordRef &record_ref);
+    void collectRun(const BPlusNode &leaf, std::size_t pos, std::vector<RecordRef> &out, int *pages_read = nullptr);
+    std::size_t freeRun(const BPlusNode &leaf, std::size_t pos); // returns the RIDs dropped
+
+    // Bulk loading
+    static std::size_t buildChunks(WorkStealingPool *workers);
+    static std::vector<std::size_t> groupBounds(std::size_t items, std::size_t capacity);
+    std::vector<NodePtr> createLevel(std::size_t count, NodeType type);
+    void clearTree();
+    void evenLastLeaves(std::vector<NodePtr> &level, std::vector<float> &level_min);
+    void buildInternalLevels(std::vector<NodePtr> &level, std::vector<float> &level_min, double fill_factor,
+                             WorkStealingPool *workers);
+
+    // Disk-resident saves go through <index>.journal: the pages are made durable there first, then
+    // written in place. recoverJournal finishes a save that was cut short.
+    // Free ids that do not fit the header page are spread over free_list_pages, taken from those ids
+    void encodeHeaderPage(char *page, std::vector<BPlusNode> &free_list_pages) const;
+    std::string journalFilename() const;
+    bool recoverJournal();
+    std::size_t savePagesInPlace(); // pages written, 0 on failure
+    // Between operations: writes the modified pages back once there are as many as cache frames
+    void writeBackIfFull();
 
   public:
-    BPlusTree(int max_keys = 100, const std::string &filename = "bplus_tree.idx");
-    ~BPlusTree() = default;
+    // With max_keys 0 node capacities follow from the page layout (LEAF_MAX_KEYS, INTERNAL_MAX_KEYS);
+    // a positive max_keys lowers both, e.g. to get a deep tree out of little data
+    BPlusTree(int max_keys = 0, const std::string &filename = "bplus_tree.idx");
+    ~BPlusTree();
+
+    BPlusTree(const BPlusTree &) = delete;
+    BPlusTree &operator=(const BPlusTree &) = delete;
 
     // Core operations
     void insert(float key, const RecordRef &record_ref);
-    void bulkLoad(std::vector<std::pair<float, RecordRef>> &data);
+
+    // Replaces the tree with one built bottom-up from data (sorted in place): leaves are packed
+    // with n * fill_factor keys, duplicates sharing one run, and each internal level is built in
+    // a single pass over the one below. With workers, the sort and every level are split across
+    // them; the tree is the same either way. Not logged; save the tree afterwards.
+    void bulkLoad(std::vector<std::pair<float, RecordRef>> &data, double fill_factor = 1.0,
+                  WorkStealingPool *workers = nullptr);
+
+    // Same bottom-up build from entries already in sorted order, pulled one at a time from next (e.g. an
+    // ExternalSorter), so the input never has to be held in memory. False if the keys go backwards.
+    bool bulkLoadSorted(const std::function<bool(IndexEntry &)> &next, double fill_factor = 1.0,
+                        WorkStealingPool *workers = nullptr);
+
     std::vector<RecordRef> search(float key);
 
     // Range search operations for Task 3
@@ -121,10 +160,18 @@ class BPlusTree
     {
         return n;
     }
+    int getInternalN() const
+    {
+        return internal_n;
+    }
     int getTotalNodes() const
     {
         return total_nodes;
     }
+    int getOverflowPages() const
+    {
+        return overflow_pages;
+    }
     int getTreeLevels() const
     {
         return tree_height;
@@ -133,7 +180,27 @@ class BPlusTree
 
     void printStatistics();
 
-    // Disk operations
-    void saveToDisk();
-    void loadFromDisk();
+    // Logs insert, deleteKey and deleteGreaterThan from now on; nullptr stops logging (e.g. during redo)
+    void attachLog(WriteAheadLog *log)
+    {
+        wal = log;
+    }
+
+    // Disk operations. The index file is a page file: a header page, then node id k at page k.
+    // saveToDisk writes a temporary file, syncs it and renames it over the old index.
+    bool saveToDisk();
+    bool loadFromDisk(); // false when there is no valid index file
+
+    // Writes every entry, in key order, as a read-only IndexSnapshot; the tree itself is unchanged
+    bool freeze(const std::string &snapshot_filename);
+
+    // Disk-resident alternative to loadFromDisk: only the header page is read, nodes are faulted in
+    // through a cache of cache_nodes pages (LRU) as lookups reach them. Modified pages are held in
+    // memory until saveToDisk, which then writes only those, or until there are cache_nodes of them.
+    // A bulk load returns to an in-memory tree.
+    bool openFromDisk(std::size_t cache_nodes = INDEX_CACHE_NODES);
+    bool isDiskResident() const
+    {
+        return cache != nullptr;
+    }
 };
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "block.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+enum class ReplacementPolicy
+{
+    LRU,
+    CLOCK,
+    TWO_Q
+};
+
+// Picks which unpinned frame to evict when the pool is full
+class Replacer
+{
+  public:
+    virtual ~Replacer() = default;
+
+    // Called whenever a frame is handed out, hit == false when it was just loaded
+    virtual void recordAccess(std::size_t frame_id, std::uint32_t block_id, bool hit) = 0;
+    virtual void setEvictable(std::size_t frame_id, bool evictable) = 0;
+    virtual bool victim(std::size_t &frame_id) = 0;
+    // Takes back a frame victim() handed out that could not be evicted after all, as evictable
+    virtual void restore(std::size_t frame_id, std::uint32_t block_id) = 0;
+    virtual void remove(std::size_t frame_id) = 0;
+};
+
+std::unique_ptr<Replacer> makeReplacer(ReplacementPolicy policy, std::size_t num_frames);
+
+// Fixed-size cache of Block frames over a block-structured file
+class BufferPool
+{
+  private:
+    struct Frame
+    {
+        Block block;
+        std::uint32_t block_id = 0;
+        int pin_count = 0;
+        bool dirty = false;
+    };
+
+    std::string filename;
+    int fd;
+    std::vector<Frame> frames;
+    std::vector<std::size_t> freeFrames;
+    std::unordered_map<std::uint32_t, std::size_t> pageTable;
+    std::unique_ptr<Replacer> replacer;
+    ReplacementPolicy policy;
+    std::mutex latch;
+    std::function<bool()> writeBackHook;
+
+    std::size_t hits;
+    std::size_t misses;
+    std::size_t reads;
+    std::size_t writes;
+
+    bool openFile();
+    bool readBlock(std::uint32_t block_id, Block &block);
+    bool writeBlock(std::uint32_t block_id, const Block &block);
+    bool acquireFrame(std::size_t &frame_id);
+
+  public:
+    BufferPool(const std::string &filename, std::size_t num_frames = 256,
+               ReplacementPolicy policy = ReplacementPolicy::LRU);
+    ~BufferPool();
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    // Pins the block in memory; every successful fetch must be paired with unpinBlock
+    Block *fetchBlock(std::uint32_t block_id);
+    bool unpinBlock(std::uint32_t block_id, bool is_dirty);
+
+    bool flushBlock(std::uint32_t block_id);
+    bool flushAll();
+
+    // fdatasync of the file, so blocks already written back survive a crash
+    bool sync();
+
+    // Runs before any dirty block is written back (eviction or flush); a false return keeps the
+    // block in memory. The write-ahead log uses it to get its records to disk first.
+    void setWriteBackHook(std::function<bool()> hook);
+
+    // Drops every frame without writing back, e.g. after the file was rewritten underneath us
+    void reset();
+
+    std::size_t getNumFrames() const
+    {
+        return frames.size();
+    }
+    std::size_t getHits() const
+    {
+        return hits;
+    }
+    std::size_t getMisses() const
+    {
+        return misses;
+    }
+    std::size_t getReads() const
+    {
+        return reads;
+    }
+    std::size_t getWrites() const
+    {
+        return writes;
+    }
+    void resetStats();
+
+    void printStatistics() const;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "constants.h"
+#include "page.h"
+#include "record.h"
+#include <cstdint>
+#include <string>
+
+// Bumped whenever the on-disk page format changes
+inline constexpr std::uint32_t DB_FORMAT_VERSION = 1;
+
+// Everything needed to reopen data.db without reading it, kept in <filename>.cat
+struct Catalog
+{
+    std::uint32_t format_version = DB_FORMAT_VERSION;
+    std::uint32_t block_size = BLOCK_SIZE;
+    std::uint32_t record_size = RECORD_SIZE;
+    std::uint32_t max_records_per_block = MAX_RECORDS_PER_BLOCK;
+    FieldInfo fields[RECORD_FIELD_COUNT] = {};
+    PageLayout layout = PageLayout::ROW; // for blocks written from now on
+    bool clean_shutdown = false;         // false while mutations may not have reached data.db
+    std::uint64_t total_records = 0;
+    std::uint64_t total_blocks = 0;
+};
+
+// Catalog describing this build's Record and page format
+Catalog currentCatalog();
+
+// True when catalog was written for the Record and page format this build uses
+bool matchesSchema(const Catalog &catalog);
+
+// Written to a temporary file, synced and renamed over the old catalog
+bool saveCatalog(const std::string &filename, const Catalog &catalog);
+bool loadCatalog(const std::string &filename, Catalog &catalog);
@@ -3,11 +3,15 @@
 #include "record.h"
 #include "utils.h"
 #include <cstddef>
+#include <cstdint>
 #include <string_view>
 
 // Assume using modern filesystem which by default use 4k blocks
 inline constexpr std::size_t BLOCK_SIZE = 4096;
-inline constexpr std::size_t MAX_RECORDS_PER_BLOCK = BLOCK_SIZE / sizeof(Record);
 inline constexpr std::size_t RECORD_SIZE = sizeof(Record);
+// Every data block is a slotted page: a small header and one validity bit per slot come out of the 4k
+inline constexpr std::size_t PAGE_HEADER_SIZE = 2 * sizeof(std::uint16_t) + 2 * sizeof(std::uint8_t);
+inline constexpr std::size_t MAX_RECORDS_PER_BLOCK = (8 * (BLOCK_SIZE - PAGE_HEADER_SIZE)) / (8 * RECORD_SIZE + 1);
+inline constexpr std::size_t PAGE_BITMAP_SIZE = (MAX_RECORDS_PER_BLOCK + 7) / 8;
 inline constexpr std::size_t EPOCH_YEAR = 2000;
 inline constexpr std::string_view DATA_FILE = "data/games.txt";
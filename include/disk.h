@@ -1,46 +1,246 @@
 #pragma once
 #include "bplus_tree.h"
+#include "buffer_pool.h"
+#include "catalog.h"
+#include "free_space_map.h"
+#include "mapped_file.h"
+#include "page.h"
+#include "predicate.h"
 #include "record.h"
+#include "wal.h"
+#include "zone_map.h"
 #include <cstddef>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+enum class StorageBackend
+{
+    BUFFER_POOL, // blocks are copied into pool frames with pread
+    MMAP         // blocks are served straight from a shared mapping of data.db
+};
+
+// How the Disk accesses data.db
+struct DiskOptions
+{
+    StorageBackend backend = StorageBackend::BUFFER_POOL;
+    std::size_t pool_frames = 256;
+    ReplacementPolicy replacement_policy = ReplacementPolicy::LRU;
+
+    // Block reads kept in flight by getRecords; 0 keeps the synchronous path
+    unsigned async_queue_depth = 0;
+
+    // Parser threads used by loadData; 0 uses every hardware thread. Output is identical for any value.
+    unsigned ingest_threads = 0;
+
+    // How loadData lays records out inside each block; readers follow whatever each page says
+    PageLayout layout = PageLayout::ROW;
+
+    // Log every delete/insert to <filename>.wal before applying it. The buffer pool then never
+    // writes a block back ahead of its log records; the MMAP backend cannot promise that, as the
+    // kernel may write mapped pages at any time.
+    bool write_ahead_log = false;
+};
+
+// count/sum/min/max of one field over the live records
+struct ColumnSummary
+{
+    std::size_t count = 0;
+    double sum = 0;
+    double min = 0;
+    double max = 0;
+};
+
+// Receives each record together with where it was stored
+using RecordSink = std::function<void(const Record &, const RecordRef &)>;
+
+// A B+ tree kept in step with inserts, keyed on one field of the record
+struct RegisteredIndex
+{
+    BPlusTree *tree;
+    RecordField key_field;
+};
+
 class Disk
 {
   private:
     std::string filename;
     std::size_t ttlBlks;
     std::size_t ttlRecs;
-    std::vector<Record> records; // Store loaded records for indexing
+    DiskOptions options;
+    std::vector<RecordSink> ingestSinks; // e.g. index builders fed while loading
+    std::vector<RegisteredIndex> indexes; // maintained by insertRecords
+    FreeSpaceMap freeSpace;
+    ZoneMap zoneMap; // persisted as <filename>.zmap
+    std::unique_ptr<WriteAheadLog> wal; // declared before pool, which flushes through it on destruction
+    bool markedUnclean; // the catalog on disk currently says clean_shutdown = false
+    std::unique_ptr<BufferPool> pool; // every block access after loading goes through here
+    std::unique_ptr<MappedFile> mapped; // only set for StorageBackend::MMAP
+    mutable std::mutex mapLatch;        // serialises (re)mapping when scans run on several threads
+
+    // Pins a block through whichever backend is active; pair every call with unpinBlock
+    Block *pinBlock(std::uint32_t block_id) const;
+    void unpinBlock(std::uint32_t block_id, bool is_dirty) const;
+    void adviseAccess(AccessPattern pattern) const;
+
+    // Packs records pulled from next into blocks and streams them to data.db
+    bool ingest(const std::function<bool(Record &)> &next);
+
+    // <filename>.cat with the current counts
+    bool writeCatalog(bool clean_shutdown);
+
+    // Flags the catalog unclean (once) before the first mutation after a checkpoint
+    void markUnclean();
+
+    // Rebuilds zone map, free-space map and record count from the page headers, after a crash
+    void rebuildMetadata();
+
+    // Writes blocks past the current end of data.db with one sequential write, bypassing the pool
+    bool appendBlocks(const std::vector<Block> &blocks);
+
+    void logInsert(const RecordRef &ref, const Record &rec);
 
   public:
-    Disk(const std::string &filename = "./data/data.db");
+    Disk(const std::string &filename = "./data/data.db", const DiskOptions &options = DiskOptions{});
     ~Disk() = default;
 
+    // Streams games.txt into data.db with bounded memory, feeding every ingest sink on the way
     bool loadData();
+
+    // Opens the data.db left by an earlier run from its catalog, without touching the data when it
+    // was shut down cleanly; after a crash the metadata is rebuilt from the page headers and the
+    // caller should run recover(). False when there is no usable database to open.
+    bool open();
     Record parseTxtData(const std::string &data_file);
 
     bool writeToDisk(const std::vector<Record> &records);
 
+    // Sinks registered before loadData see every (record, RecordRef) as it is placed
+    void addIngestSink(RecordSink sink);
+
     int getTtlBlks() const;
-    int getTtlRecs() const;
+    int getTtlRecs() const; // live records, deletes are subtracted
+
+    // Live records stored in one block
+    std::size_t recordsInBlock(std::uint32_t block_id) const;
+
+    // Full scan of data.db in block order through the active backend
+    void scanRecords(const RecordSink &visit) const;
+
+    // Same walk handing out whole pinned blocks, for scans that read single fields (see page.h).
+    // With prune set, blocks the zone map proves hold no match are skipped without being read.
+    // Both return the number of blocks visited.
+    std::size_t scanBlocks(const std::function<void(std::uint32_t block_id, const Block &block)> &visit,
+                           const ScanPredicate *prune = nullptr) const;
+
+    // Blocks [begin, end) only; safe to call from several threads at once on disjoint ranges
+    std::size_t scanBlockRange(std::uint32_t begin, std::uint32_t end,
+                               const std::function<void(std::uint32_t block_id, const Block &block)> &visit,
+                               const ScanPredicate *prune = nullptr) const;
+
+    // Single-field aggregate; on PAX pages only that field's minipage is read
+    ColumnSummary summarizeColumn(RecordField field) const;
+
+    // Streams field of every live record, as an index key, to visit in block order; only that
+    // column is read, which on PAX pages is one contiguous minipage per block
+    void scanIndexKeys(RecordField field, const std::function<void(float key, const RecordRef &ref)> &visit) const;
 
-    // Under Review
     // Method to get all FT_PCT_home values with their record references for indexing
     std::vector<std::pair<float, RecordRef>> getAllFTPctHomeValues() const;
 
-    // Method to retrieve a record using RecordRef (block_id + record_offset)
+    // Method to retrieve a record using RecordRef (block_id + record_offset).
+    // A deleted slot reads back as an all-zero Record, use isRecordLive to tell them apart.
     Record getRecord(const RecordRef& ref) const;
+    bool isRecordLive(const RecordRef& ref) const;
 
     // Method to retrieve multiple records using RecordRefs
     std::vector<Record> getRecords(const std::vector<RecordRef>& refs) const;
 
-    // Method to delete a record by marking it as deleted
+    // Same as getRecords, also returns the number of distinct data blocks read.
+    // Refs are grouped by block so each block is fetched once; results keep the caller's order.
+    std::pair<std::vector<Record>, int> getRecordsWithStats(const std::vector<RecordRef>& refs) const;
+
+    // Streams records to on_record as their blocks complete (io_uring, or a pread thread pool),
+    // keeping up to queue_depth block reads in flight. index is the position in refs.
+    // Returns the number of distinct blocks read.
+    int getRecordsAsync(const std::vector<RecordRef>& refs,
+                        const std::function<void(std::size_t index, const Record&)>& on_record,
+                        unsigned queue_depth = 32) const;
+
+    // Zero-copy access for the MMAP backend: pointers into the mapping, nullptr for the
+    // buffer pool backend and for PAX pages, whose rows are not contiguous.
+    // They stay valid until the file is rewritten or grows.
+    const Record *viewRecord(const RecordRef& ref) const;
+    std::vector<const Record *> viewRecords(const std::vector<RecordRef>& refs) const;
+
+    // Inserts feed every registered index from then on; the tree must outlive the registration
+    void registerIndex(BPlusTree *index, RecordField key_field = RecordField::FT_PCT_HOME);
+    void unregisterIndex(BPlusTree *index);
+
+    // Stores rec in a free slot (see insertRecords); false if it could not be placed
+    bool insertRecord(const Record &rec, RecordRef &ref);
+
+    // Places records into the free slots the free-space map knows of, each such block pinned once,
+    // then packs the rest into new blocks appended to data.db with a single write. Every registered
+    // index gets the new entries in key order. Returns where each record went, in input order;
+    // a shorter result means the rest could not be stored.
+    std::vector<RecordRef> insertRecords(const std::vector<Record> &records);
+
+    // Method to delete a record by clearing its slot's validity bit; false if it was not live
     bool deleteRecord(const RecordRef& ref);
 
     // Method to delete multiple records
     int deleteRecords(const std::vector<RecordRef>& refs);
 
+    // Batched delete: refs are grouped by block, each affected block is pinned once, all of its
+    // slots are tombstoned in memory and the block is written back with a single write. sync
+    // adds one fdatasync (msync for MMAP) at the end. Returns {records deleted, blocks touched}.
+    std::pair<int, int> deleteRecordsWithStats(const std::vector<RecordRef>& refs, bool sync = false);
+
+    // Writes back every dirty block held by the buffer pool, or msyncs the mapping, and saves the zone map
+    bool flush();
+
+    // Makes every logged mutation durable with one group commit; true when no log is kept
+    bool commitLog();
+
+    // Flushes and syncs data.db, saves the zone map and the index (if given), then empties the log
+    bool checkpoint(BPlusTree *index = nullptr);
+
+    // Redo pass over the log: reapplies every logged data and index operation. All of them are
+    // idempotent, so records already reflected on disk are harmless. Returns the records replayed.
+    std::size_t recover(BPlusTree *index = nullptr);
+
+    WriteAheadLog *getLog() const
+    {
+        return wal.get();
+    }
+
+    StorageBackend getBackend() const
+    {
+        return options.backend;
+    }
+
+    const BufferPool &getBufferPool() const
+    {
+        return *pool;
+    }
+    // Zeroes the buffer pool counters so they cover only what runs after, e.g. one measured task
+    void resetPoolStats()
+    {
+        if (pool)
+            pool->resetStats();
+    }
+    const FreeSpaceMap &getFreeSpaceMap() const
+    {
+        return freeSpace;
+    }
+    const ZoneMap &getZoneMap() const
+    {
+        return zoneMap;
+    }
+
     void printStats() const;
 };
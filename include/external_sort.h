@@ -0,0 +1,110 @@
+#pragma once
+
+#include "bplus_tree.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class WorkStealingPool;
+
+// Memory an index build may use for sorting unless told otherwise
+inline constexpr std::size_t DEFAULT_SORT_MEMORY = 64u << 20;
+
+// Most runs merged at once; more than that are first merged into longer runs in extra passes
+inline constexpr std::size_t MAX_MERGE_FAN_IN = 256;
+
+// Bytes one entry takes in a run file: key, block id, record offset
+inline constexpr std::size_t RUN_ENTRY_SIZE = sizeof(float) + sizeof(std::uint32_t) + sizeof(std::uint16_t);
+
+// Sorts more (key, RecordRef) pairs than fit in memory. Entries are collected until the memory
+// budget is used up, then sorted (see sortIndexEntries) and spilled to a run file
+// <run_prefix>.<n>. finish() k-way merges the runs through a loser tree and next() hands the
+// merged stream out one entry at a time, in the order std::sort would give. When nothing had to
+// be spilled the entries are sorted and streamed from memory instead. Run files are removed once
+// merged, and by the destructor.
+class ExternalSorter
+{
+  private:
+    // Sequential reader over one run file with its own slice of the memory budget
+    struct RunReader
+    {
+        std::FILE *file = nullptr;
+        std::vector<char> buffer;
+        std::size_t begin = 0;
+        std::size_t end = 0;
+        IndexEntry current;
+        bool exhausted = false;
+
+        bool advance();
+    };
+
+    std::string runPrefix;
+    std::size_t memoryBudget;
+    std::size_t runCapacity; // entries buffered before a spill
+    WorkStealingPool *workers;
+
+    std::vector<IndexEntry> pending;
+    std::vector<std::string> runFiles; // runs not merged yet, oldest first
+    std::size_t nextRunId;
+    std::size_t spilledRuns;
+    std::size_t mergePasses;
+
+    std::vector<RunReader> readers; // runs being merged
+    std::vector<std::string> readerFiles;
+    std::vector<std::size_t> losers; // losers[0] is the winner, losers[1..k) the internal nodes
+    std::size_t inMemoryPos;
+    std::size_t entryCount;
+    bool finished;
+    bool failed;
+
+    bool spill();
+    bool writeRun(const std::string &run, const std::function<bool(IndexEntry &)> &next);
+
+    // Loser tree over the given runs, which are deleted again by closeRuns
+    bool openRuns(std::vector<std::string> runs);
+    bool popSmallest(IndexEntry &entry);
+    void closeRuns();
+    bool beats(std::size_t a, std::size_t b) const;
+    std::size_t initLoserTree(std::size_t node);
+
+  public:
+    // The radix sort needs a second buffer of the same size, so a run holds at most
+    // memory_budget / (2 * sizeof(IndexEntry)) entries
+    ExternalSorter(const std::string &run_prefix, std::size_t memory_budget = DEFAULT_SORT_MEMORY,
+                   WorkStealingPool *workers = nullptr);
+    ~ExternalSorter();
+
+    ExternalSorter(const ExternalSorter &) = delete;
+    ExternalSorter &operator=(const ExternalSorter &) = delete;
+
+    // Only before finish()
+    bool add(const IndexEntry &entry);
+
+    // Ends the input and prepares the merge; false if any run could not be written or reopened
+    bool finish();
+
+    // Next entry in sorted order; false at the end of the stream or after a read error
+    bool next(IndexEntry &entry);
+
+    std::size_t getEntryCount() const
+    {
+        return entryCount;
+    }
+    // Sorted runs written by spills, not counting those of intermediate merge passes
+    std::size_t getRunCount() const
+    {
+        return spilledRuns;
+    }
+    std::size_t getMergePasses() const
+    {
+        return mergePasses;
+    }
+    bool hasFailed() const
+    {
+        return failed;
+    }
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <vector>
+
+// Free slot count of every block in data.db, so inserts can fill holes left by deletes
+// before the file is extended
+class FreeSpaceMap
+{
+  private:
+    std::vector<std::uint16_t> freeSlots;
+    std::set<std::uint32_t> blocksWithSpace;
+
+  public:
+    void reset(std::size_t num_blocks = 0);
+    void update(std::uint32_t block_id, std::size_t free_slots);
+
+    // Lowest block id with at least one free slot
+    bool findBlockWithSpace(std::uint32_t &block_id) const;
+
+    std::size_t getFreeSlots(std::uint32_t block_id) const;
+    std::size_t getNumBlocks() const
+    {
+        return freeSlots.size();
+    }
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "bplus_tree.h"
+#include "mapped_file.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Separator keys per snapshot node: one 64-byte cache line of floats
+inline constexpr std::size_t SNAPSHOT_NODE_KEYS = 16;
+inline constexpr std::size_t SNAPSHOT_FANOUT = SNAPSHOT_NODE_KEYS + 1;
+// Enough levels for 16 * 17^12 entries
+inline constexpr std::size_t MAX_SNAPSHOT_LEVELS = 12;
+
+// Immutable, read-optimized copy of a B+ tree, written by BPlusTree::freeze and memory-mapped back.
+// Leaves are one sorted key array and a parallel array of packed RIDs. The internal levels above them
+// form a CSS-tree: every node is a cache line of 16 separators, stored level by level, and child i of
+// node j is node 17j + i of the next level, so a lookup reads one line per level and no pointers.
+// Opening maps the file and checks its header; nothing else is read until a lookup touches it.
+class IndexSnapshot
+{
+  private:
+    MappedFile file;
+    const float *levelNodes[MAX_SNAPSHOT_LEVELS];
+    std::size_t levels;
+    const float *keys;    // padded with +inf to whole nodes
+    const char *ridBytes; // PACKED_REF_SIZE bytes each
+    std::size_t entryCount;
+
+    // Position of the first entry >= key (or > key with at_most); adds the key lines read, one node per
+    // level and the leaf node, to lines_read
+    std::size_t position(float key, bool at_most, int *lines_read = nullptr) const;
+    RecordRef rid(std::size_t i) const;
+    std::vector<RecordRef> collect(std::size_t begin, std::size_t end) const;
+
+  public:
+    explicit IndexSnapshot(const std::string &filename);
+
+    IndexSnapshot(const IndexSnapshot &) = delete;
+    IndexSnapshot &operator=(const IndexSnapshot &) = delete;
+
+    // Lays entries, sorted by key, out as a snapshot file; replaces filename atomically
+    static bool write(const std::string &filename, const std::vector<IndexEntry> &entries);
+
+    bool open(); // false when the file is missing or not a snapshot
+    bool isOpen() const
+    {
+        return file.isMapped();
+    }
+
+    std::vector<RecordRef> search(float key) const;
+    std::vector<RecordRef> searchRange(float min_key, float max_key) const;
+    std::vector<RecordRef> searchGreaterThan(float key) const;
+    // Also returns the 64-byte cache lines the search read: the key lines of the descent and every
+    // line of RIDs it collected. The B+ tree's counterpart counts 4096-byte pages instead.
+    std::pair<std::vector<RecordRef>, int> searchGreaterThanWithStats(float key) const;
+
+    std::size_t size() const
+    {
+        return entryCount;
+    }
+    std::size_t getLevels() const
+    {
+        return levels;
+    }
+};
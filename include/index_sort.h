@@ -0,0 +1,29 @@
+#pragma once
+
+#include "bplus_tree.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+class WorkStealingPool;
+
+// Inputs smaller than this go to std::sort, the radix passes do not pay off
+inline constexpr std::size_t RADIX_SORT_MIN_ENTRIES = 1 << 12;
+
+// Maps a float to an unsigned integer with the same ordering (-0.0 and 0.0 map alike)
+inline std::uint32_t sortableKeyBits(float key)
+{
+    if (key == 0.0f)
+        key = 0.0f;
+
+    std::uint32_t bits;
+    std::memcpy(&bits, &key, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+// Sorts entries into the same order as std::sort on the pairs: LSD radix sort on the key bits, one
+// byte per pass with every pass split over the workers, then each run of equal keys by RecordRef.
+// Passes where all keys share the byte are skipped. Runs on the calling thread without workers.
+void sortIndexEntries(std::vector<IndexEntry> &entries, WorkStealingPool *workers = nullptr);
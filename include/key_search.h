@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+
+enum class KeySearchKernel
+{
+    AUTO, // best kernel the CPU supports
+    SCALAR,
+    SSE2,
+    AVX2,
+    AVX512
+};
+
+// Keys compared per step at the end of a search: halving stops once this few are left
+inline constexpr std::size_t KEY_SEARCH_WINDOW = 32;
+
+// Best kernel available on this CPU
+KeySearchKernel detectKeySearchKernel();
+const char *keySearchKernelName(KeySearchKernel kernel);
+
+// Position of key in the sorted keys[0, count): the number of keys below it (lower bound) or at most
+// it (upper bound). Branch-free halving narrows the keys down to KEY_SEARCH_WINDOW, which are then
+// compared all at once and the matches counted. Without a kernel the one detected for this CPU is used.
+std::size_t countKeysBelow(const float *keys, std::size_t count, float key);
+std::size_t countKeysAtMost(const float *keys, std::size_t count, float key);
+std::size_t countKeysBelow(const float *keys, std::size_t count, float key, KeySearchKernel kernel);
+std::size_t countKeysAtMost(const float *keys, std::size_t count, float key, KeySearchKernel kernel);
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+enum class AccessPattern
+{
+    NORMAL,
+    SEQUENTIAL, // full scans
+    RANDOM      // index-driven fetches
+};
+
+// Shared memory mapping of a whole file. Writes through data() land in the page cache
+// and are visible to every other reader of the file.
+class MappedFile
+{
+  private:
+    std::string filename;
+    bool writable;
+    int fd;
+    char *base;
+    std::size_t length;
+    mutable AccessPattern pattern; // last advice, applied again whenever the file is (re)mapped
+
+  public:
+    MappedFile(const std::string &filename, bool writable = false);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Maps the file at its current size; calling it again picks up growth
+    bool map();
+    void unmap();
+
+    bool isMapped() const
+    {
+        return base != nullptr;
+    }
+    char *data() const
+    {
+        return base;
+    }
+    std::size_t size() const
+    {
+        return length;
+    }
+
+    // Remembered when nothing is mapped yet, so advice given before the first map() still applies
+    void advise(AccessPattern pattern) const;
+    bool sync() const;
+};
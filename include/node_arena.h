@@ -0,0 +1,72 @@
+#pragma once
+
+#include "bplus_node.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// Node pages indexed by node id. Pages are allocated a chunk of ARENA_CHUNK_NODES at a time and
+// never move, so a BPlusNode * stays valid until the node is released or the arena cleared; a
+// lookup is two array indexes. Unused and released pages are zero pages (NodeType::FREE).
+class NodeArena
+{
+  private:
+    static constexpr std::size_t ARENA_CHUNK_NODES = 256;
+
+    std::vector<std::unique_ptr<BPlusNode[]>> chunks;
+    std::size_t live; // pages allocated and not released
+
+  public:
+    NodeArena() : live(0)
+    {
+    }
+
+    // Page of node_id, nullptr when there is no such node
+    BPlusNode *find(std::uint32_t node_id) const
+    {
+        std::size_t chunk = node_id / ARENA_CHUNK_NODES;
+        if (chunk >= chunks.size())
+            return nullptr;
+        BPlusNode *node = &chunks[chunk][node_id % ARENA_CHUNK_NODES];
+        return node->header()->type == NodeType::FREE ? nullptr : node;
+    }
+
+    // Page for node_id, still FREE; the caller initializes it
+    BPlusNode *allocate(std::uint32_t node_id)
+    {
+        std::size_t chunk = node_id / ARENA_CHUNK_NODES;
+        while (chunks.size() <= chunk)
+            chunks.push_back(std::make_unique<BPlusNode[]>(ARENA_CHUNK_NODES));
+        live++;
+        return &chunks[chunk][node_id % ARENA_CHUNK_NODES];
+    }
+
+    // Only for pages handed out by allocate
+    void release(std::uint32_t node_id)
+    {
+        std::memset(chunks[node_id / ARENA_CHUNK_NODES][node_id % ARENA_CHUNK_NODES].data, 0, BLOCK_SIZE);
+        live--;
+    }
+
+    // Calls visit(node_id, node) for every page that is not FREE, in id order
+    template <typename Visitor> void forEach(Visitor &&visit) const
+    {
+        for (std::size_t chunk = 0; chunk < chunks.size(); chunk++)
+            for (std::size_t slot = 0; slot < ARENA_CHUNK_NODES; slot++)
+                if (chunks[chunk][slot].header()->type != NodeType::FREE)
+                    visit(static_cast<std::uint32_t>(chunk * ARENA_CHUNK_NODES + slot), chunks[chunk][slot]);
+    }
+
+    void clear()
+    {
+        chunks.clear();
+        live = 0;
+    }
+
+    std::size_t size() const
+    {
+        return live;
+    }
+};
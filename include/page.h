@@ -0,0 +1,229 @@
+#pragma once
+
+#include "block.h"
+#include "constants.h"
+#include "record.h"
+#include <cstdint>
+#include <cstring>
+
+// Slotted page layout of a data block:
+//   [slot_count u16][live_count u16][layout u8][reserved u8][validity bitmap, 1 bit per slot][record area]
+// slot_count is the high-water mark of slots ever used; a cleared bit is a tombstone
+// that a later insert may reuse.
+//
+// The record area is either row-wise (ROW: slot i holds a whole packed Record) or PAX
+// (one minipage per field: column f starts at MAX_RECORDS_PER_BLOCK * offset of f, and
+// slot i's value sits at i * size of f inside it). Both fill exactly the same bytes.
+
+enum class PageLayout : std::uint8_t
+{
+    ROW = 0,
+    PAX = 1
+};
+
+#pragma pack(push, 1)
+struct PageHeader
+{
+    std::uint16_t slot_count;
+    std::uint16_t live_count;
+    PageLayout layout;
+    std::uint8_t reserved;
+};
+#pragma pack(pop)
+
+inline constexpr std::size_t PAGE_SLOTS_OFFSET = PAGE_HEADER_SIZE + PAGE_BITMAP_SIZE;
+
+static_assert(sizeof(PageHeader) == PAGE_HEADER_SIZE, "PageHeader must match PAGE_HEADER_SIZE");
+static_assert(PAGE_SLOTS_OFFSET + MAX_RECORDS_PER_BLOCK * RECORD_SIZE <= BLOCK_SIZE, "slotted page overflows a block");
+
+inline PageHeader *pageHeader(Block &block)
+{
+    return reinterpret_cast<PageHeader *>(block.data);
+}
+
+inline const PageHeader *pageHeader(const Block &block)
+{
+    return reinterpret_cast<const PageHeader *>(block.data);
+}
+
+inline const std::uint8_t *pageBitmap(const Block &block)
+{
+    return reinterpret_cast<const std::uint8_t *>(block.data + PAGE_HEADER_SIZE);
+}
+
+inline std::uint8_t *pageBitmap(Block &block)
+{
+    return reinterpret_cast<std::uint8_t *>(block.data + PAGE_HEADER_SIZE);
+}
+
+inline void initPage(Block &block, PageLayout layout = PageLayout::ROW)
+{
+    std::memset(block.data, 0, BLOCK_SIZE);
+    pageHeader(block)->layout = layout;
+}
+
+inline PageLayout pageLayout(const Block &block)
+{
+    return pageHeader(block)->layout;
+}
+
+inline bool isSlotLive(const Block &block, std::size_t slot)
+{
+    return slot < MAX_RECORDS_PER_BLOCK && (pageBitmap(block)[slot / 8] >> (slot % 8)) & 1;
+}
+
+// Whole packed Record of a ROW page; PAX pages have no such thing
+inline const char *slotData(const Block &block, std::size_t slot)
+{
+    return block.data + PAGE_SLOTS_OFFSET + slot * RECORD_SIZE;
+}
+
+// Start of field's values: its minipage on a PAX page, the first record's copy on a ROW page
+inline std::size_t fieldOffset(PageLayout layout, RecordField field, std::size_t slot)
+{
+    const FieldInfo &info = fieldInfo(field);
+    if (layout == PageLayout::PAX)
+        return PAGE_SLOTS_OFFSET + MAX_RECORDS_PER_BLOCK * info.offset + slot * info.size;
+    return PAGE_SLOTS_OFFSET + slot * RECORD_SIZE + info.offset;
+}
+
+// Contiguous values of one field for every slot of a PAX page, nullptr on a ROW page
+inline const char *columnData(const Block &block, RecordField field)
+{
+    if (pageLayout(block) != PageLayout::PAX)
+        return nullptr;
+    return block.data + fieldOffset(PageLayout::PAX, field, 0);
+}
+
+// One field of one slot; T must match the field's type
+template <typename T> T readField(const Block &block, RecordField field, std::size_t slot)
+{
+    T value;
+    std::memcpy(&value, block.data + fieldOffset(pageLayout(block), field, slot), sizeof(T));
+    return value;
+}
+
+// Any field widened to double, for aggregates that do not care about the type
+inline double readFieldAsDouble(const Block &block, RecordField field, std::size_t slot)
+{
+    switch (field)
+    {
+    case RecordField::FG_PCT_HOME:
+    case RecordField::FT_PCT_HOME:
+    case RecordField::FG3_PCT_HOME:
+        return readField<float>(block, field, slot);
+    case RecordField::TEAM_ID_HOME:
+        return readField<std::uint32_t>(block, field, slot);
+    case RecordField::GAME_DATE_EST:
+        return readField<std::uint16_t>(block, field, slot);
+    default:
+        return readField<std::uint8_t>(block, field, slot);
+    }
+}
+
+inline Record readSlot(const Block &block, std::size_t slot)
+{
+    Record record;
+    if (pageLayout(block) == PageLayout::ROW)
+    {
+        std::memcpy(&record, slotData(block, slot), RECORD_SIZE);
+        return record;
+    }
+
+    // Stitch the row back together from every minipage
+    char *out = reinterpret_cast<char *>(&record);
+    for (std::size_t f = 0; f < RECORD_FIELD_COUNT; f++)
+    {
+        const FieldInfo &info = RECORD_FIELDS[f];
+        std::memcpy(out + info.offset, block.data + fieldOffset(PageLayout::PAX, static_cast<RecordField>(f), slot),
+                    info.size);
+    }
+    return record;
+}
+
+// Stores rec in slot and marks it live
+inline void writeSlot(Block &block, std::size_t slot, const Record &rec)
+{
+    PageHeader *header = pageHeader(block);
+    if (header->layout == PageLayout::ROW)
+    {
+        std::memcpy(block.data + PAGE_SLOTS_OFFSET + slot * RECORD_SIZE, &rec, RECORD_SIZE);
+    }
+    else
+    {
+        const char *in = reinterpret_cast<const char *>(&rec);
+        for (std::size_t f = 0; f < RECORD_FIELD_COUNT; f++)
+        {
+            const FieldInfo &info = RECORD_FIELDS[f];
+            std::memcpy(block.data + fieldOffset(PageLayout::PAX, static_cast<RecordField>(f), slot),
+                        in + info.offset, info.size);
+        }
+    }
+
+    if (!isSlotLive(block, slot))
+    {
+        pageBitmap(block)[slot / 8] |= static_cast<std::uint8_t>(1u << (slot % 8));
+        header->live_count++;
+    }
+    if (slot >= header->slot_count)
+        header->slot_count = static_cast<std::uint16_t>(slot + 1);
+}
+
+// Flips the slot's validity bit off; false if it was not live
+inline bool eraseSlot(Block &block, std::size_t slot)
+{
+    if (!isSlotLive(block, slot))
+        return false;
+
+    pageBitmap(block)[slot / 8] &= static_cast<std::uint8_t>(~(1u << (slot % 8)));
+    pageHeader(block)->live_count--;
+    return true;
+}
+
+inline std::size_t pageFreeSlots(const Block &block)
+{
+    return MAX_RECORDS_PER_BLOCK - pageHeader(block)->live_count;
+}
+
+// First tombstoned slot, else the next never-used slot; -1 when the page is full
+inline int findFreeSlot(const Block &block)
+{
+    const PageHeader *header = pageHeader(block);
+    const std::uint8_t *bitmap = pageBitmap(block);
+
+    for (std::size_t byte = 0; byte * 8 < header->slot_count; byte++)
+    {
+        if (bitmap[byte] == 0xFF)
+            continue;
+        for (std::size_t slot = byte * 8; slot < byte * 8 + 8 && slot < header->slot_count; slot++)
+            if (!isSlotLive(block, slot))
+                return static_cast<int>(slot);
+    }
+
+    return header->slot_count < MAX_RECORDS_PER_BLOCK ? header->slot_count : -1;
+}
+
+// Calls visit(slot) for every set bit among the first slot_count, skipping empty bytes eight slots at a time
+template <typename Visitor> void forEachSetBit(const std::uint8_t *bitmap, std::size_t slot_count, Visitor &&visit)
+{
+    for (std::size_t byte = 0; byte * 8 < slot_count; byte++)
+    {
+        std::uint8_t bits = bitmap[byte];
+        while (bits)
+        {
+            std::size_t slot = byte * 8 + static_cast<std::size_t>(__builtin_ctz(bits));
+            visit(slot);
+            bits &= static_cast<std::uint8_t>(bits - 1);
+        }
+    }
+}
+
+// Calls visit(slot) for every live slot
+template <typename Visitor> void forEachLiveSlot(const Block &block, Visitor &&visit)
+{
+    const PageHeader *header = pageHeader(block);
+    if (header->live_count == 0)
+        return;
+
+    forEachSetBit(pageBitmap(block), header->slot_count, visit);
+}
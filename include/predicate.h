@@ -0,0 +1,23 @@
+#pragma once
+
+#include "record.h"
+
+enum class CompareOp
+{
+    LT,
+    LE,
+    GT,
+    GE,
+    EQ,
+    BETWEEN // value <= field <= high
+};
+
+// field <op> value. Float fields are compared in float precision, so GT 0.9 means > 0.9f
+// exactly like the B+ tree search.
+struct ScanPredicate
+{
+    RecordField field;
+    CompareOp op;
+    double value;
+    double high = 0; // upper bound, BETWEEN only
+};
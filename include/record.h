@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 #pragma pack(push, 1)
@@ -17,3 +18,73 @@ struct Record
     std::uint8_t home_team_wins;
 };
 #pragma pack(pop)
+
+// Columns of Record, in declaration order
+enum class RecordField : std::uint8_t
+{
+    FG_PCT_HOME,
+    FT_PCT_HOME,
+    FG3_PCT_HOME,
+    TEAM_ID_HOME,
+    GAME_DATE_EST,
+    PTS_HOME,
+    AST_HOME,
+    REB_HOME,
+    HOME_TEAM_WINS
+};
+
+struct FieldInfo
+{
+    std::size_t offset; // byte offset inside Record
+    std::size_t size;
+};
+
+inline constexpr FieldInfo RECORD_FIELDS[] = {
+    {offsetof(Record, fg_pct_home), sizeof(float)},
+    {offsetof(Record, ft_pct_home), sizeof(float)},
+    {offsetof(Record, fg3_pct_home), sizeof(float)},
+    {offsetof(Record, team_ID_home), sizeof(std::uint32_t)},
+    {offsetof(Record, game_date_est), sizeof(std::uint16_t)},
+    {offsetof(Record, pts_home), sizeof(std::uint8_t)},
+    {offsetof(Record, ast_home), sizeof(std::uint8_t)},
+    {offsetof(Record, reb_home), sizeof(std::uint8_t)},
+    {offsetof(Record, home_team_wins), sizeof(std::uint8_t)},
+};
+
+inline constexpr std::size_t RECORD_FIELD_COUNT = sizeof(RECORD_FIELDS) / sizeof(RECORD_FIELDS[0]);
+
+inline constexpr const FieldInfo &fieldInfo(RecordField field)
+{
+    return RECORD_FIELDS[static_cast<std::size_t>(field)];
+}
+
+inline constexpr bool isFloatField(RecordField field)
+{
+    return field == RecordField::FG_PCT_HOME || field == RecordField::FT_PCT_HOME ||
+           field == RecordField::FG3_PCT_HOME;
+}
+
+inline double recordFieldAsDouble(const Record &rec, RecordField field)
+{
+    switch (field)
+    {
+    case RecordField::FG_PCT_HOME:
+        return rec.fg_pct_home;
+    case RecordField::FT_PCT_HOME:
+        return rec.ft_pct_home;
+    case RecordField::FG3_PCT_HOME:
+        return rec.fg3_pct_home;
+    case RecordField::TEAM_ID_HOME:
+        return rec.team_ID_home;
+    case RecordField::GAME_DATE_EST:
+        return rec.game_date_est;
+    case RecordField::PTS_HOME:
+        return rec.pts_home;
+    case RecordField::AST_HOME:
+        return rec.ast_home;
+    case RecordField::REB_HOME:
+        return rec.reb_home;
+    default:
+        return rec.home_team_wins;
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "block.h"
+#include "constants.h"
+#include "disk.h"
+#include "predicate.h"
+#include "record.h"
+#include "thread_pool.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+enum class ScanKernel
+{
+    AUTO, // best kernel the CPU supports
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+struct ScanStats
+{
+    std::size_t blocks_read = 0;
+    std::size_t blocks_skipped = 0; // ruled out by the zone map without being read
+    std::size_t rows_matched = 0;
+};
+
+// Blocks per unit of work handed to a parallel scan worker
+inline constexpr std::size_t SCAN_MORSEL_BLOCKS = 8;
+
+// Best kernel available on this CPU
+ScanKernel detectScanKernel();
+const char *scanKernelName(ScanKernel kernel);
+
+// Full-table scan of data.db filtered by one predicate. Blocks whose zone map rules the predicate
+// out are skipped; float fields are compared eight values at a time with AVX2 or SSE2, the rest
+// go through the scalar path.
+class ScanOperator
+{
+  private:
+    ScanPredicate predicate;
+    ScanKernel kernel;
+    bool zonePruning;
+
+    const ScanPredicate *pruneWith() const
+    {
+        return zonePruning ? &predicate : nullptr;
+    }
+
+  public:
+    // Kernels the CPU lacks are downgraded to the best one it has
+    ScanOperator(const ScanPredicate &predicate, ScanKernel kernel = ScanKernel::AUTO);
+
+    // Fills mask (PAGE_BITMAP_SIZE bytes, laid out like the validity bitmap) with the live slots
+    // of block that satisfy the predicate and returns how many there are
+    std::size_t matchBlock(const Block &block, std::uint8_t *mask) const;
+
+    // Hands every matching row to on_match in block order
+    ScanStats run(const Disk &disk, const RecordSink &on_match) const;
+
+    // Matching locations only, rows are never assembled
+    std::vector<RecordRef> collectRefs(const Disk &disk, ScanStats *stats = nullptr) const;
+
+    // The block range is cut into morsels of SCAN_MORSEL_BLOCKS and spread over workers.
+    // ordered keeps the serial scan's block order; otherwise each worker's matches stay together.
+    std::vector<RecordRef> collectRefsParallel(const Disk &disk, WorkStealingPool &workers, bool ordered = true,
+                                               ScanStats *stats = nullptr) const;
+
+    // Summary of field over the matching rows. Partial results are merged in block order, so the
+    // answer does not depend on the number of workers.
+    ColumnSummary aggregateParallel(const Disk &disk, RecordField field, WorkStealingPool &workers,
+                                    ScanStats *stats = nullptr) const;
+
+    ScanKernel getKernel() const
+    {
+        return kernel;
+    }
+
+    // On by default; off reads every block, e.g. to measure a plain full scan
+    void setZonePruning(bool enabled)
+    {
+        zonePruning = enabled;
+    }
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads draining a shared FIFO of tasks
+class ThreadPool
+{
+  private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable taskReady;
+    std::condition_variable allDone;
+    std::size_t running;
+    bool stopping;
+
+    void workerLoop();
+
+  public:
+    explicit ThreadPool(std::size_t num_threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void submit(std::function<void()> task);
+
+    // Blocks until the queue is empty and no task is running
+    void waitIdle();
+
+    std::size_t size() const
+    {
+        return workers.size();
+    }
+};
+
+// Fixed set of workers for data-parallel loops. Each worker owns a deque of task indices and
+// takes from its front; once it runs dry it steals from the back of the others', so a few slow
+// tasks do not leave the remaining threads idle.
+class WorkStealingPool
+{
+  private:
+    struct TaskQueue
+    {
+        std::mutex mutex;
+        std::deque<std::size_t> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    const std::function<void(std::size_t, unsigned)> *job;
+    std::mutex mutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+    std::size_t generation;
+    std::atomic<std::size_t> pending;
+    bool stopping;
+
+    bool nextTask(unsigned worker, std::size_t &task);
+    void workerLoop(unsigned worker);
+
+  public:
+    explicit WorkStealingPool(std::size_t num_threads);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    // Runs fn(task, worker) for every task in [0, num_tasks) and returns once all have finished.
+    // Each worker starts on its own contiguous run of tasks. One caller at a time.
+    void parallelFor(std::size_t num_tasks, const std::function<void(std::size_t task, unsigned worker)> &fn);
+
+    std::size_t size() const
+    {
+        return workers.size();
+    }
+};
+
+// parallelFor on workers, or a plain loop on the calling thread when workers is null
+void runTasks(WorkStealingPool *workers, std::size_t num_tasks, const std::function<void(std::size_t task)> &fn);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "record.h"
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Parses one games.txt row (without its line terminator). Fields are located with memchr and
+// converted with std::from_chars, so nothing is allocated; empty fields become 0.
+Record parseGameRow(std::string_view line);
+
+// Parses every complete row of text (blank lines are skipped) and appends them to out
+void parseGameRows(std::string_view text, std::vector<Record> &out);
+
+// Reads a tab-separated file through one large buffer and hands out one row at a time
+class TsvReader
+{
+  private:
+    std::FILE *file;
+    std::vector<char> buffer;
+    std::size_t begin; // first unconsumed byte
+    std::size_t end;   // one past the last valid byte
+    bool eof;
+
+    bool refill();
+
+  public:
+    TsvReader(const std::string &filename, std::size_t buffer_size = 1 << 20);
+    ~TsvReader();
+
+    TsvReader(const TsvReader &) = delete;
+    TsvReader &operator=(const TsvReader &) = delete;
+
+    bool isOpen() const
+    {
+        return file != nullptr;
+    }
+
+    // The views are only valid until the next call
+    bool nextLine(std::string_view &line);
+
+    // Roughly a buffer's worth of whole lines, ending just after a newline (or at end of file)
+    bool nextChunk(std::string_view &chunk);
+
+    bool next(Record &rec);
+};
@@ -1,8 +1,57 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
+#include <string_view>
+
+// Length of a DD/MM/YYYY date as written by formatDate_2Byte (no terminator)
+inline constexpr std::size_t DATE_STRING_LENGTH = 10;
+
+struct CivilDate
+{
+    int year;
+    int month;
+    int day;
+};
+
+// Days since 1970-01-01 of a proleptic Gregorian date in constant time (Howard Hinnant's days_from_civil)
+constexpr int daysFromCivil(int year, int month, int day)
+{
+    year -= month <= 2 ? 1 : 0;
+    const int era = (year >= 0 ? year : year - 399) / 400;
+    const int yoe = year - era * 400;                                         // [0, 399]
+    const int doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1; // [0, 365]
+    const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;                    // [0, 146096]
+    return era * 146097 + doe - 719468;
+}
+
+// Inverse of daysFromCivil
+constexpr CivilDate civilFromDays(int days)
+{
+    days += 719468;
+    const int era = (days >= 0 ? days : days - 146096) / 146097;
+    const int doe = days - era * 146097;                                   // [0, 146096]
+    const int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365; // [0, 399]
+    const int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);               // [0, 365]
+    const int mp = (5 * doy + 2) / 153;                                    // [0, 11], March based
+    const int day = doy - (153 * mp + 2) / 5 + 1;
+    const int month = mp < 10 ? mp + 3 : mp - 9;
+    return CivilDate{yoe + era * 400 + (month <= 2 ? 1 : 0), month, day};
+}
 
 bool isLeapYear(const int year);
-std::uint16_t dateToInt_2Byte(const std::string &s);
+std::uint16_t dateToInt_2Byte(std::string_view s);
 std::string intToDate_2Byte(std::uint16_t days_since_epoch);
+
+// Writes DD/MM/YYYY into out (DATE_STRING_LENGTH chars, no terminator) and returns one past the end
+char *formatDate_2Byte(std::uint16_t days_since_epoch, char *out);
+
+// Column-at-a-time versions for whole game_date_est columns. out of formatDates_2Byte
+// receives count * DATE_STRING_LENGTH chars, one date after another.
+void datesToInt_2Byte(const std::string_view *dates, std::size_t count, std::uint16_t *out);
+void formatDates_2Byte(const std::uint16_t *days_since_epoch, std::size_t count, char *out);
+
+// Syncs temp_filename, renames it over target_filename and syncs the directory, so after a crash the
+// target is either the old file or the complete new one. False if any step fails.
+bool replaceFileDurably(const std::string &temp_filename, const std::string &target_filename);
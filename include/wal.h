@@ -0,0 +1,89 @@
+#pragma once
+
+#include "bplus_tree.h"
+#include "record.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+enum class LogType : std::uint8_t
+{
+    DATA_DELETE = 1,          // ref
+    DATA_INSERT = 2,          // ref, record
+    INDEX_INSERT = 3,         // key, ref
+    INDEX_DELETE = 4,         // key, ref
+    INDEX_DELETE_GREATER = 5  // key
+};
+
+struct LogRecord
+{
+    std::uint64_t lsn = 0; // assigned by append
+    LogType type = LogType::DATA_DELETE;
+    RecordRef ref;
+    float key = 0.0f;
+    Record record{};
+};
+
+// Append-only redo log. Records are buffered by append and made durable by commit; concurrent
+// committers share one write + fdatasync (group commit). Every logged operation is idempotent
+// to redo, so the log only needs to be truncated after a checkpoint, never trimmed.
+class WriteAheadLog
+{
+  private:
+    std::string filename;
+    int fd;
+    std::mutex mutex;
+    std::condition_variable flushed;
+    std::vector<char> buffer; // serialised records not yet written
+    std::uint64_t nextLsn;
+    std::uint64_t durableLsn;
+    off_t durableOffset; // end of the records fdatasync has confirmed
+    bool flushing;
+    bool failed; // a flush could not be undone; nothing more is accepted as durable
+
+    std::size_t appends;
+    std::size_t syncs;
+
+  public:
+    explicit WriteAheadLog(const std::string &filename);
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+    // Opens (or creates) the log and positions after its last intact record
+    bool open();
+
+    // Buffers the record and returns its LSN; nothing is written yet
+    std::uint64_t append(LogRecord record);
+
+    // Returns once every record up to lsn is on disk. Whoever arrives while no flush is running
+    // writes out everything buffered so far, later callers ride along or wait for the next one.
+    // A failed write is cut off the file and its records stay buffered for the next commit; after a
+    // failed fdatasync, or a write that cannot be cut off, every later commit fails.
+    bool commit(std::uint64_t lsn);
+    bool commitAll();
+
+    // Every intact record in log order; reading stops at the first torn or corrupt one
+    bool readAll(std::vector<LogRecord> &records) const;
+
+    // Drops the whole log once its effects are in data.db and the index file
+    bool truncate();
+
+    const std::string &getFilename() const
+    {
+        return filename;
+    }
+    std::size_t getAppendCount() const
+    {
+        return appends;
+    }
+    std::size_t getSyncCount() const
+    {
+        return syncs;
+    }
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "block.h"
+#include "predicate.h"
+#include "record.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Range of one column over the live records of a block
+struct ColumnZone
+{
+    double min = 0;
+    double max = 0;
+    std::uint32_t zero_count = 0; // empty fields are stored as 0
+};
+
+struct BlockZone
+{
+    std::uint32_t live_count = 0;
+    ColumnZone columns[RECORD_FIELD_COUNT];
+};
+
+// Per-block min/max/zero counts of every Record column, kept next to data.db in a sidecar file.
+// A block whose zones cannot satisfy a predicate does not need to be read at all.
+class ZoneMap
+{
+  private:
+    std::vector<BlockZone> zones;
+
+    void recomputeColumn(std::uint32_t block_id, const Block &block, RecordField field);
+
+  public:
+    void reset();
+
+    // Recomputes the block's zones from its live slots
+    void rebuildBlock(std::uint32_t block_id, const Block &block);
+
+    // Called after slot has been tombstoned; its bytes are still in block
+    void removeSlot(std::uint32_t block_id, const Block &block, std::size_t slot);
+
+    // False only when no live record of the block can satisfy predicate
+    bool mayMatch(std::uint32_t block_id, const ScanPredicate &predicate) const;
+
+    const BlockZone *getZone(std::uint32_t block_id) const;
+    std::size_t getNumBlocks() const
+    {
+        return zones.size();
+    }
+
+    // Written aside and renamed over filename durably; the catalog may only record a clean shutdown after it
+    bool save(const std::string &filename) const;
+    bool load(const std::string &filename);
+};
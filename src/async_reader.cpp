@@ -0,0 +1,403 @@
+#include "async_reader.h"
+#include "constants.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING 1
+// <linux/fs.h> comes in with io_uring.h and defines its own BLOCK_SIZE (1024)
+#undef BLOCK_SIZE
+#endif
+
+// Minimal io_uring wrapper over the raw syscalls, enough to queue reads and reap completions
+class IoUring
+{
+#ifdef HAVE_IO_URING
+  private:
+    int ringFd = -1;
+
+    void *sqRing = nullptr;
+    std::size_t sqRingSize = 0;
+    void *cqRing = nullptr;
+    std::size_t cqRingSize = 0;
+    io_uring_sqe *sqes = nullptr;
+    std::size_t sqesSize = 0;
+
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned *sqMask = nullptr;
+    unsigned *sqEntries = nullptr;
+    unsigned *sqArray = nullptr;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned *cqMask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+
+    unsigned toSubmit = 0;
+
+  public:
+    static std::unique_ptr<IoUring> create(unsigned entries)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+
+        int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0)
+            return nullptr; // kernel too old, or io_uring disabled by policy
+
+        auto ring = std::unique_ptr<IoUring>(new IoUring());
+        ring->ringFd = fd;
+
+        ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap)
+            ring->sqRingSize = ring->cqRingSize = std::max(ring->sqRingSize, ring->cqRingSize);
+
+        ring->sqRing = ::mmap(nullptr, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                              IORING_OFF_SQ_RING);
+        if (ring->sqRing == MAP_FAILED)
+        {
+            ring->sqRing = nullptr;
+            return nullptr;
+        }
+
+        if (single_mmap)
+        {
+            ring->cqRing = ring->sqRing;
+        }
+        else
+        {
+            ring->cqRing = ::mmap(nullptr, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                  fd, IORING_OFF_CQ_RING);
+            if (ring->cqRing == MAP_FAILED)
+            {
+                ring->cqRing = nullptr;
+                return nullptr;
+            }
+        }
+
+        ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = ::mmap(nullptr, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                            IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return nullptr;
+        ring->sqes = static_cast<io_uring_sqe *>(sqes);
+
+        char *sq = static_cast<char *>(ring->sqRing);
+        ring->sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        ring->sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        ring->sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        ring->sqEntries = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+        ring->sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+        char *cq = static_cast<char *>(ring->cqRing);
+        ring->cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        ring->cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        ring->cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        ring->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+        return ring;
+    }
+
+    ~IoUring()
+    {
+        if (sqes)
+            ::munmap(sqes, sqesSize);
+        if (cqRing && cqRing != sqRing)
+            ::munmap(cqRing, cqRingSize);
+        if (sqRing)
+            ::munmap(sqRing, sqRingSize);
+        if (ringFd >= 0)
+            ::close(ringFd);
+    }
+
+    // Queues one vectored read; nothing reaches the kernel until submit()
+    bool queueRead(int fd, iovec *iov, off_t offset, std::uint64_t user_data)
+    {
+        unsigned tail = *sqTail;
+        unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (tail - head >= *sqEntries)
+            return false;
+
+        unsigned index = tail & *sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<std::uint64_t>(iov);
+        sqe->len = 1;
+        sqe->off = static_cast<std::uint64_t>(offset);
+        sqe->user_data = user_data;
+
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        toSubmit++;
+        return true;
+    }
+
+    // Hands queued reads to the kernel and optionally waits for wait_nr completions
+    bool submit(unsigned wait_nr)
+    {
+        while (true)
+        {
+            unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+            long ret = ::syscall(__NR_io_uring_enter, ringFd, toSubmit, wait_nr, flags, nullptr, 0);
+            if (ret >= 0)
+            {
+                toSubmit -= std::min<unsigned>(toSubmit, static_cast<unsigned>(ret));
+                return true;
+            }
+            if (errno != EINTR)
+                return false;
+        }
+    }
+
+    bool popCompletion(std::uint64_t &user_data, int &result)
+    {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail)
+            return false;
+
+        const io_uring_cqe &cqe = cqes[head & *cqMask];
+        user_data = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+#else
+  public:
+    static std::unique_ptr<IoUring> create(unsigned)
+    {
+        return nullptr;
+    }
+    bool queueRead(int, iovec *, off_t, std::uint64_t)
+    {
+        return false;
+    }
+    bool submit(unsigned)
+    {
+        return false;
+    }
+    bool popCompletion(std::uint64_t &, int &)
+    {
+        return false;
+    }
+#endif
+};
+
+namespace
+{
+
+// Pads a block whose read stopped at end of file; false if nothing was read at all
+bool finishBlock(Block &block, std::size_t bytes_read)
+{
+    if (bytes_read == 0)
+        return false;
+    if (bytes_read < BLOCK_SIZE)
+        std::memset(block.data + bytes_read, 0, BLOCK_SIZE - bytes_read);
+    return true;
+}
+
+} // namespace
+
+AsyncBlockReader::AsyncBlockReader(const std::string &filename, unsigned queue_depth)
+    : filename{filename}, queueDepth{queue_depth == 0 ? 1 : queue_depth}, fd{-1}
+{
+    fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Cannot open database file: " << filename << '\n';
+        return;
+    }
+
+    ring = IoUring::create(queueDepth);
+}
+
+AsyncBlockReader::~AsyncBlockReader()
+{
+    ring.reset();
+    if (fd >= 0)
+        ::close(fd);
+}
+
+std::size_t AsyncBlockReader::readBlocks(const std::vector<std::uint32_t> &block_ids, const Callback &on_block)
+{
+    if (fd < 0 || block_ids.empty())
+        return 0;
+
+    if (ring)
+        return readWithIoUring(block_ids, on_block);
+    return readWithThreads(block_ids, on_block);
+}
+
+std::size_t AsyncBlockReader::readWithIoUring(const std::vector<std::uint32_t> &block_ids, const Callback &on_block)
+{
+    std::vector<Block> buffers(queueDepth);
+    std::vector<iovec> iovecs(queueDepth);
+    std::vector<std::uint32_t> slotBlock(queueDepth);
+    std::vector<std::size_t> slotDone(queueDepth);
+    std::vector<std::size_t> freeSlots;
+    for (std::size_t slot = queueDepth; slot > 0; slot--)
+        freeSlots.push_back(slot - 1);
+    // Short reads whose remainder did not fit the submission ring; they go in ahead of new blocks
+    std::vector<std::size_t> requeueSlots;
+
+    // Reads are allowed to come back short, so a slot may be queued several times
+    auto queueSlot = [&](std::size_t slot) {
+        iovecs[slot].iov_base = buffers[slot].data + slotDone[slot];
+        iovecs[slot].iov_len = BLOCK_SIZE - slotDone[slot];
+        off_t offset = static_cast<off_t>(slotBlock[slot]) * BLOCK_SIZE + static_cast<off_t>(slotDone[slot]);
+        return ring->queueRead(fd, &iovecs[slot], offset, slot);
+    };
+
+    std::size_t next = 0;
+    std::size_t in_flight = 0;
+    std::size_t delivered = 0;
+
+    while (next < block_ids.size() || in_flight > 0)
+    {
+        while (!requeueSlots.empty() && queueSlot(requeueSlots.back()))
+            requeueSlots.pop_back();
+
+        while (requeueSlots.empty() && next < block_ids.size() && !freeSlots.empty())
+        {
+            std::size_t slot = freeSlots.back();
+            slotBlock[slot] = block_ids[next];
+            slotDone[slot] = 0;
+            if (!queueSlot(slot))
+                break; // submission ring full, submit what we have first
+
+            freeSlots.pop_back();
+            next++;
+            in_flight++;
+        }
+
+        // A remainder still waiting on the ring may be the only read left, so do not block on completions
+        if (!ring->submit(requeueSlots.empty() ? 1 : 0))
+        {
+            std::cerr << "io_uring submission failed: " << std::strerror(errno) << '\n';
+            return delivered;
+        }
+
+        std::uint64_t slot;
+        int result;
+        while (ring->popCompletion(slot, result))
+        {
+            if (result > 0)
+                slotDone[slot] += static_cast<std::size_t>(result);
+
+            // Still in flight for the remainder; a block cut short mid-file is never padded and delivered
+            if (result > 0 && slotDone[slot] < BLOCK_SIZE)
+            {
+                if (!queueSlot(slot))
+                    requeueSlots.push_back(slot);
+                continue;
+            }
+
+            in_flight--;
+            if (result >= 0 && finishBlock(buffers[slot], slotDone[slot]))
+            {
+                on_block(slotBlock[slot], buffers[slot]);
+                delivered++;
+            }
+            else
+            {
+                std::cerr << "Cannot read block " << slotBlock[slot] << " from " << filename << '\n';
+            }
+            freeSlots.push_back(slot);
+        }
+    }
+
+    return delivered;
+}
+
+std::size_t AsyncBlockReader::readWithThreads(const std::vector<std::uint32_t> &block_ids, const Callback &on_block)
+{
+    std::vector<Block> buffers(queueDepth);
+    std::vector<std::uint32_t> slotBlock(queueDepth);
+    std::vector<std::size_t> freeSlots;
+    for (std::size_t slot = queueDepth; slot > 0; slot--)
+        freeSlots.push_back(slot - 1);
+
+    std::mutex mutex;
+    std::condition_variable completed;
+    std::deque<std::pair<std::size_t, long>> completions;
+
+    // Declared after everything the tasks touch, so it is joined before any of that is destroyed: a worker
+    // can still be inside notify_one() when the last completion has already been consumed
+    ThreadPool workers(queueDepth);
+
+    std::size_t next = 0;
+    std::size_t in_flight = 0;
+    std::size_t delivered = 0;
+
+    while (next < block_ids.size() || in_flight > 0)
+    {
+        while (next < block_ids.size() && !freeSlots.empty())
+        {
+            std::size_t slot = freeSlots.back();
+            freeSlots.pop_back();
+            slotBlock[slot] = block_ids[next++];
+            in_flight++;
+
+            workers.submit([&, slot] {
+                off_t offset = static_cast<off_t>(slotBlock[slot]) * BLOCK_SIZE;
+                long done = 0;
+                while (done < static_cast<long>(BLOCK_SIZE))
+                {
+                    long n = ::pread(fd, buffers[slot].data + done, BLOCK_SIZE - done, offset + done);
+                    if (n < 0 && errno == EINTR)
+                        continue;
+                    if (n < 0)
+                        done = -1;
+                    if (n <= 0)
+                        break;
+                    done += n;
+                }
+                {
+                    std::lock_guard<std::mutex> guard(mutex);
+                    completions.emplace_back(slot, done);
+                }
+                completed.notify_one();
+            });
+        }
+
+        std::deque<std::pair<std::size_t, long>> ready;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            completed.wait(lock, [&] { return !completions.empty(); });
+            ready.swap(completions);
+        }
+
+        for (const auto &[slot, bytes_read] : ready)
+        {
+            in_flight--;
+            if (bytes_read >= 0 && finishBlock(buffers[slot], static_cast<std::size_t>(bytes_read)))
+            {
+                on_block(slotBlock[slot], buffers[slot]);
+                delivered++;
+            }
+            else
+            {
+                std::cerr << "Cannot read block " << slotBlock[slot] << " from " << filename << '\n';
+            }
+            freeSlots.push_back(slot);
+        }
+    }
+
+    return delivered;
+}
@@ -1,274 +1,777 @@
 #include "bplus_tree.h"
+#include "index_snapshot.h"
+#include "index_sort.h"
+#include "thread_pool.h"
+#include "utils.h"
+#include "wal.h"
 #include <algorithm>
+#include <cstdio>
 #include <cstring>
+#include <fcntl.h>
 #include <iostream>
 #include <queue>
+#include <unistd.h>
 
-BPlusTree::BPlusTree(int max_keys, const std::string &filename)
-    : root(nullptr), n(max_keys), next_node_id(1), index_filename(filename), total_nodes(0), tree_height(0)
+namespace
+{
+
+// Page 0 of the index file
+struct IndexFileHeader
+{
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t block_size;
+    std::uint32_t leaf_keys;
+    std::uint32_t internal_keys;
+    std::uint32_t root_id;
+    std::uint32_t next_node_id;
+    std::uint32_t total_nodes;
+    std::uint32_t overflow_pages;
+    std::uint32_t tree_height;
+    std::uint32_t free_list_head; // first FREE_LIST page, 0 when every free id fits in here
+    std::uint32_t free_count;     // free page ids following the header
+};
+
+constexpr std::uint32_t INDEX_FILE_MAGIC = 0x42505047; // "BPPG"
+constexpr std::uint32_t INDEX_FILE_VERSION = 3;
+constexpr std::size_t MAX_HEADER_FREE_IDS = (BLOCK_SIZE - sizeof(IndexFileHeader)) / sizeof(std::uint32_t);
+
+// Journal of a disk-resident save: (page id, page) records, then the trailer
+constexpr std::uint32_t JOURNAL_MAGIC = 0x42504a4e; // "BPJN"
+
+bool decodeHeaderPage(const char *page, IndexFileHeader &header, std::vector<std::uint32_t> &free_ids)
 {
+    std::memcpy(&header, page, sizeof(header));
+    if (header.magic != INDEX_FILE_MAGIC || header.version != INDEX_FILE_VERSION || header.block_size != BLOCK_SIZE ||
+        header.leaf_keys < 2 || header.leaf_keys > LEAF_MAX_KEYS || header.internal_keys < 2 ||
+        header.internal_keys > INTERNAL_MAX_KEYS || header.free_count > MAX_HEADER_FREE_IDS ||
+        header.root_id >= header.next_node_id || header.free_list_head >= header.next_node_id)
+        return false;
+
+    free_ids.resize(header.free_count);
+    if (header.free_count > 0)
+        std::memcpy(free_ids.data(), page + sizeof(header), header.free_count * sizeof(std::uint32_t));
+    return true;
+}
 
-    if (n <= 0)
+// Appends the ids on the FREE_LIST chain starting at head, and the chain's own pages, to free_ids
+bool readFreeList(std::ifstream &file, std::uint32_t head, std::uint32_t next_node_id,
+                  std::vector<std::uint32_t> &free_ids)
+{
+    BPlusNode page;
+    std::uint32_t pages = 0;
+    for (std::uint32_t id = head; id != 0; id = page.header()->next)
     {
-        n = 100; // Default optimal value from our calculation
+        // A chain can never be longer than the file, so a cycle shows up as one that is
+        file.seekg(static_cast<std::streamoff>(id) * BLOCK_SIZE);
+        if (id >= next_node_id || ++pages >= next_node_id || !file.read(page.data, BLOCK_SIZE) ||
+            page.header()->type != NodeType::FREE_LIST || page.header()->node_id != id ||
+            page.keyCount() > FREE_LIST_CAPACITY)
+            return false;
+
+        free_ids.push_back(id);
+        free_ids.insert(free_ids.end(), page.freeIds(), page.freeIds() + page.keyCount());
     }
+    return true;
 }
 
-NodePtr BPlusTree::createNode(bool is_leaf)
+bool syncAndClose(int fd)
+{
+    bool synced = ::fdatasync(fd) == 0;
+    return ::close(fd) == 0 && synced;
+}
+
+} // namespace
+
+BPlusTree::BPlusTree(int max_keys, const std::string &filename)
+    : root_id(0), n(LEAF_MAX_KEYS), internal_n(INTERNAL_MAX_KEYS), next_node_id(1), index_filename(filename),
+      wal(nullptr), total_nodes(0), overflow_pages(0), tree_height(0), write_backs(0)
 {
-    auto node = std::make_shared<BPlusNode>(is_leaf);
-    node->node_id = next_node_id++;
-    node->keys.reserve(n);
+    // A leaf needs two keys to split into two non-empty halves
+    if (max_keys > 0)
+    {
+        n = std::clamp(max_keys, 2, n);
+        internal_n = std::clamp(max_keys, 2, internal_n);
+    }
+}
 
-    if (is_leaf)
+NodePtr BPlusTree::createNode(NodeType type)
+{
+    std::uint32_t node_id;
+    if (!free_ids.empty())
+    {
+        node_id = free_ids.back();
+        free_ids.pop_back();
+    }
+    else
     {
-        node->values.reserve(n);
-        node->next_leaf = 0;
+        node_id = next_node_id++;
     }
+
+    if (type == NodeType::OVERFLOW)
+        overflow_pages++;
     else
+        total_nodes++;
+
+    NodePtr node = nodes.allocate(node_id);
+    node->init(type, node_id);
+    return node;
+}
+
+BPlusTree::~BPlusTree() = default;
+
+NodePtr BPlusTree::getNode(std::uint32_t node_id) const
+{
+    if (NodePtr node = nodes.find(node_id))
+        return node;
+    if (!cache || node_id == 0 || node_id >= next_node_id)
+        return nullptr;
+
+    // Disk-resident: fault the page in, pinned until the operation lets go of it
+    Block *block = cache->fetchBlock(node_id);
+    if (!block)
+        return nullptr;
+    pinned.push_back(node_id);
+
+    NodePtr node = reinterpret_cast<NodePtr>(block);
+    return node->isFree() ? nullptr : node;
+}
+
+void BPlusTree::releasePins(std::size_t mark) const
+{
+    while (pinned.size() > mark)
     {
-        node->children.reserve(n + 1);
+        cache->unpinBlock(pinned.back(), false);
+        pinned.pop_back();
     }
+}
+
+NodePtr BPlusTree::writable(NodePtr node)
+{
+    std::uint32_t node_id = node->header()->node_id;
+    if (!cache || nodes.find(node_id) == node)
+        return node;
 
-    nodes[node->node_id] = node;
+    NodePtr copy = nodes.allocate(node_id);
+    std::memcpy(copy->data, node->data, BLOCK_SIZE);
+    return copy;
+}
+
+NodePtr BPlusTree::writableNode(std::uint32_t node_id)
+{
+    std::size_t mark = pinMark();
+    NodePtr node = getNode(node_id);
+    if (node)
+        node = writable(node);
+    releasePins(mark);
     return node;
 }
 
+void BPlusTree::freeNode(NodePtr node)
+{
+    std::uint32_t node_id = node->header()->node_id;
+    if (node->header()->type == NodeType::OVERFLOW)
+        overflow_pages--;
+    else
+        total_nodes--;
+
+    // A cached page needs no release, the id alone is written back as a zero page
+    if (nodes.find(node_id))
+        nodes.release(node_id);
+    free_ids.push_back(node_id);
+}
+
 void BPlusTree::insert(float key, const RecordRef &record_ref)
 {
-    if (!root)
+    writeBackIfFull();
+    PinScope scope(*this);
+    if (root_id == 0)
     {
         // Create root as leaf node
-        root = createNode(true);
-        root->is_root = true;
-        insertIntoLeaf(root, key, record_ref);
+        NodePtr root = createNode(NodeType::LEAF);
+        root->header()->is_root = 1;
+        root_id = root->header()->node_id;
+        tree_height = 1;
+    }
+
+    // The leaf is reached before logging so an unreadable page leaves no record to replay
+    std::vector<std::uint32_t> path;
+    NodePtr leaf = findLeafNode(key, &path);
+    if (!leaf)
+    {
+        std::cerr << "Cannot reach the leaf for key " << key << ", entry not inserted" << std::endl;
         return;
     }
 
-    NodePtr leaf = findLeafNode(key);
-    insertIntoLeaf(leaf, key, record_ref);
+    if (wal)
+    {
+        LogRecord entry;
+        entry.type = LogType::INDEX_INSERT;
+        entry.key = key;
+        entry.ref = record_ref;
+        wal->append(entry);
+    }
+
+    leaf = writable(leaf);
+    if (insertIntoLeaf(leaf, key, record_ref))
+        return;
 
-    // Check if leaf needs splitting
-    if ((int)leaf->keys.size() > n)
+    // Pages cannot grow past a block, so a full leaf is split before the entry goes in
+    auto [new_leaf, promote_key] = splitLeafNode(leaf);
+    insertIntoLeaf(key < promote_key ? leaf : new_leaf, key, record_ref);
+    insertIntoParent(path, leaf, promote_key, new_leaf);
+}
+
+NodePtr BPlusTree::findLeafNode(float key, std::vector<std::uint32_t> *path)
+{
+    NodePtr current = getNode(root_id);
+
+    while (current && !current->isLeaf())
     {
-        auto [new_leaf, promote_key] = splitLeafNode(leaf);
-        insertIntoParent(leaf, promote_key, new_leaf);
+        if (path)
+            path->push_back(current->header()->node_id);
+        current = getNode(current->children()[current->upperBound(key)]);
     }
+
+    return current;
 }
 
-NodePtr BPlusTree::findLeafNode(float key)
+bool BPlusTree::insertIntoLeaf(NodePtr leaf, float key, const RecordRef &record_ref)
 {
-    NodePtr current = root;
+    std::size_t pos = leaf->lowerBound(key);
 
-    while (!current->is_leaf)
+    // Check if key already exists
+    if (pos < leaf->keyCount() && leaf->keys()[pos] == key)
     {
-        int i = 0;
-        while (i < (int)current->keys.size() && key >= current->keys[i])
-        {
-            i++;
-        }
+        if (!leaf->isOverflowRun(pos) && leaf->slots()[pos].count == INLINE_RUN_LIMIT)
+            moveRunToOverflow(*leaf, pos);
 
-        if (i < (int)current->children.size())
-        {
-            auto child_it = nodes.find(current->children[i]);
-            if (child_it != nodes.end())
-            {
-                current = child_it->second;
-            }
-            else
-            {
-                break;
-            }
-        }
-        else
+        if (leaf->isOverflowRun(pos))
         {
-            break;
+            appendToOverflow(leaf->overflowHead(pos), record_ref);
+            return true;
         }
+        if (leaf->freeRids() == 0)
+            return false;
+
+        leaf->leafAddRid(pos, record_ref);
+        return true;
     }
 
-    return current;
+    // Insert new key
+    if ((int)leaf->keyCount() >= n || leaf->freeRids() == 0)
+        return false;
+
+    leaf->leafInsertKey(pos, key);
+    leaf->leafAddRid(pos, record_ref);
+    return true;
 }
 
-void BPlusTree::insertIntoLeaf(NodePtr leaf, float key, const RecordRef &record_ref)
+void BPlusTree::moveRunToOverflow(BPlusNode &leaf, std::size_t pos)
 {
-    // Find position to insert
-    auto it = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), key);
-    int pos = it - leaf->keys.begin();
+    NodePtr head = createNode(NodeType::OVERFLOW);
+    const LeafSlot &slot = leaf.slots()[pos];
+    for (std::size_t i = 0; i < slot.count; i++)
+        head->overflowAppend(leaf.rid(slot.offset + i));
 
-    // Check if key already exists
-    if (pos < (int)leaf->keys.size() && leaf->keys[pos] == key)
+    leaf.leafMakeOverflowRun(pos, head->header()->node_id);
+}
+
+void BPlusTree::appendToOverflow(std::uint32_t head, const RecordRef &record_ref)
+{
+    // Records of a key stay in insertion order, so new ones go to the tail page
+    std::size_t mark = pinMark();
+    NodePtr page = getNode(head);
+    while (page->header()->next != 0)
     {
-        // Add to existing key's values
-        leaf->values[pos].push_back(record_ref);
+        std::uint32_t next_page = page->header()->next;
+        releasePins(mark);
+        page = getNode(next_page);
     }
-    else
+
+    page = writable(page);
+    if (page->freeRids() == 0)
     {
-        // Insert new key
-        leaf->keys.insert(leaf->keys.begin() + pos, key);
-        leaf->values.insert(leaf->values.begin() + pos, std::vector<RecordRef>{record_ref});
+        NodePtr tail = createNode(NodeType::OVERFLOW);
+        page->header()->next = tail->header()->node_id;
+        page = tail;
     }
+    page->overflowAppend(record_ref);
 }
 
-void BPlusTree::insertIntoInternal(NodePtr internal, float key, std::uint32_t child_id)
+void BPlusTree::collectRun(const BPlusNode &leaf, std::size_t pos, std::vector<RecordRef> &out, int *pages_read)
 {
-    // Find position to insert
-    auto it = std::lower_bound(internal->keys.begin(), internal->keys.end(), key);
-    int pos = it - internal->keys.begin();
+    if (!leaf.isOverflowRun(pos))
+    {
+        const LeafSlot &slot = leaf.slots()[pos];
+        for (std::size_t i = 0; i < slot.count; i++)
+            out.push_back(leaf.rid(slot.offset + i));
+        return;
+    }
 
-    // Insert key and child pointer
-    internal->keys.insert(internal->keys.begin() + pos, key);
-    internal->children.insert(internal->children.begin() + pos + 1, child_id);
+    // A chain can be longer than the node cache, so only one page of it is pinned at a time
+    std::size_t mark = pinMark();
+    std::uint32_t page_id = leaf.overflowHead(pos);
+    while (page_id != 0)
+    {
+        NodePtr page = getNode(page_id);
+        if (!page)
+            break;
+        if (pages_read)
+            (*pages_read)++;
+        for (std::size_t i = 0; i < page->header()->rid_count; i++)
+            out.push_back(page->rid(i));
 
-    // Update parent relationship
-    auto child = nodes[child_id];
-    child->parent_id = internal->node_id;
+        page_id = page->header()->next;
+        releasePins(mark);
+    }
 }
 
-std::pair<NodePtr, float> BPlusTree::splitLeafNode(NodePtr leaf)
+std::size_t BPlusTree::freeRun(const BPlusNode &leaf, std::size_t pos)
 {
-    NodePtr new_leaf = createNode(true);
+    if (!leaf.isOverflowRun(pos))
+        return leaf.slots()[pos].count;
 
-    int mid = (leaf->keys.size()) / 2;
+    std::size_t dropped = 0;
+    std::size_t mark = pinMark();
+    std::uint32_t page_id = leaf.overflowHead(pos);
+    while (page_id != 0)
+    {
+        NodePtr page = getNode(page_id);
+        if (!page)
+            break;
+        page_id = page->header()->next;
+        dropped += page->header()->rid_count;
+        freeNode(page);
+        releasePins(mark);
+    }
+    return dropped;
+}
 
-    // Move half the keys to new leaf
-    new_leaf->keys.assign(leaf->keys.begin() + mid, leaf->keys.end());
-    new_leaf->values.assign(leaf->values.begin() + mid, leaf->values.end());
+std::pair<NodePtr, float> BPlusTree::splitLeafNode(NodePtr leaf)
+{
+    NodePtr new_leaf = createNode(NodeType::LEAF);
 
-    // Update original leaf
-    leaf->keys.erase(leaf->keys.begin() + mid, leaf->keys.end());
-    leaf->values.erase(leaf->values.begin() + mid, leaf->values.end());
+    // Split where the RID area is halved, which is the middle key when every key has one record
+    std::size_t count = leaf->keyCount();
+    std::size_t half = leaf->header()->rid_count / 2;
+    std::size_t mid = 1;
+    while (mid < count - 1 && leaf->slots()[mid].offset < half)
+        mid++;
 
-    // Update leaf links
-    new_leaf->next_leaf = leaf->next_leaf;
-    leaf->next_leaf = new_leaf->node_id;
+    // Move the upper runs to the new leaf
+    new_leaf->leafAppendRuns(*leaf, mid, count);
+    leaf->leafTruncate(mid);
 
-    // Set parent
-    new_leaf->parent_id = leaf->parent_id;
+    // Update leaf links
+    new_leaf->header()->next = leaf->header()->next;
+    leaf->header()->next = new_leaf->header()->node_id;
 
-    return {new_leaf, new_leaf->keys[0]};
+    return {new_leaf, new_leaf->keys()[0]};
 }
 
-std::pair<NodePtr, float> BPlusTree::splitInternalNode(NodePtr internal)
+void BPlusTree::insertIntoParent(std::vector<std::uint32_t> &path, NodePtr left, float key, NodePtr right)
 {
-    NodePtr new_internal = createNode(false);
+    if (path.empty())
+    {
+        // Create new root
+        NodePtr new_root = createNode(NodeType::INTERNAL);
+        new_root->header()->is_root = 1;
+        new_root->header()->key_count = 1;
+        new_root->keys()[0] = key;
+        new_root->children()[0] = left->header()->node_id;
+        new_root->children()[1] = right->header()->node_id;
 
-    int mid = internal->keys.size() / 2;
-    float promote_key = internal->keys[mid];
+        left->header()->is_root = 0;
 
-    // Move keys and children to new node
-    new_internal->keys.assign(internal->keys.begin() + mid + 1, internal->keys.end());
-    new_internal->children.assign(internal->children.begin() + mid + 1, internal->children.end());
+        root_id = new_root->header()->node_id;
+        tree_height++;
+        return;
+    }
+
+    // The parent is the last node passed on the way down to left
+    NodePtr parent = writableNode(path.back());
+    path.pop_back();
+    if (!parent)
+    {
+        std::cerr << "Error: Could not find parent node" << std::endl;
+        return;
+    }
 
-    // Update parent relationships for moved children
-    for (auto child_id : new_internal->children)
+    if ((int)parent->keyCount() == internal_n)
     {
-        if (nodes.find(child_id) != nodes.end())
-        {
-            nodes[child_id]->parent_id = new_internal->node_id;
-        }
+        splitInternalNode(path, parent, key, right);
+        return;
     }
 
+    // Insert key and child pointer
+    std::size_t pos = parent->lowerBound(key);
+    std::size_t count = parent->keyCount();
+    std::memmove(parent->keys() + pos + 1, parent->keys() + pos, (count - pos) * sizeof(float));
+    std::memmove(parent->children() + pos + 2, parent->children() + pos + 1, (count - pos) * sizeof(std::uint32_t));
+    parent->keys()[pos] = key;
+    parent->children()[pos + 1] = right->header()->node_id;
+    parent->header()->key_count++;
+}
+
+void BPlusTree::splitInternalNode(std::vector<std::uint32_t> &path, NodePtr internal, float key, NodePtr right)
+{
+    // The full node plus the new entry, split around the middle key
+    std::size_t count = internal->keyCount();
+    std::vector<float> keys(internal->keys(), internal->keys() + count);
+    std::vector<std::uint32_t> children(internal->children(), internal->children() + count + 1);
+
+    std::size_t pos = internal->lowerBound(key);
+    keys.insert(keys.begin() + pos, key);
+    children.insert(children.begin() + pos + 1, right->header()->node_id);
+
+    std::size_t mid = keys.size() / 2;
+    float promote_key = keys[mid];
+
+    NodePtr new_internal = createNode(NodeType::INTERNAL);
+
+    // Move keys and children to new node
+    new_internal->header()->key_count = static_cast<std::uint16_t>(keys.size() - mid - 1);
+    std::copy(keys.begin() + mid + 1, keys.end(), new_internal->keys());
+    std::copy(children.begin() + mid + 1, children.end(), new_internal->children());
+
     // Update original node
-    internal->keys.erase(internal->keys.begin() + mid, internal->keys.end());
-    internal->children.erase(internal->children.begin() + mid + 1, internal->children.end());
+    internal->header()->key_count = static_cast<std::uint16_t>(mid);
+    std::copy(keys.begin(), keys.begin() + mid, internal->keys());
+    std::copy(children.begin(), children.begin() + mid + 1, internal->children());
 
-    // Set parent
-    new_internal->parent_id = internal->parent_id;
+    insertIntoParent(path, internal, promote_key, new_internal);
+}
 
-    return {new_internal, promote_key};
+std::size_t BPlusTree::buildChunks(WorkStealingPool *workers)
+{
+    // A few chunks per worker so stealing can even out uneven ones
+    return workers ? std::max<std::size_t>(1, workers->size()) * 4 : 1;
 }
 
-void BPlusTree::insertIntoParent(NodePtr left, float key, NodePtr right)
+std::vector<std::size_t> BPlusTree::groupBounds(std::size_t items, std::size_t capacity)
 {
-    if (left->is_root)
-    {
-        // Create new root
-        NodePtr new_root = createNode(false);
-        new_root->is_root = true;
-        new_root->keys.push_back(key);
-        new_root->children.push_back(left->node_id);
-        new_root->children.push_back(right->node_id);
+    // Spreading items evenly over the minimum number of nodes keeps the last node from being a runt
+    std::size_t groups = (items + capacity - 1) / capacity;
+    std::vector<std::size_t> bounds(groups + 1);
+    for (std::size_t g = 0; g <= groups; g++)
+        bounds[g] = items * g / groups;
+    return bounds;
+}
 
-        left->is_root = false;
-        left->parent_id = new_root->node_id;
-        right->parent_id = new_root->node_id;
+std::vector<NodePtr> BPlusTree::createLevel(std::size_t count, NodeType type)
+{
+    // Nodes are created up front so ids do not depend on scheduling, then filled chunk by chunk
+    std::vector<NodePtr> level(count);
+    for (auto &node : level)
+        node = createNode(type);
+    return level;
+}
+
+void BPlusTree::clearTree()
+{
+    cache.reset();
+    pinned.clear();
+    nodes.clear();
+    free_ids.clear();
+    root_id = 0;
+    next_node_id = 1;
+    total_nodes = 0;
+    overflow_pages = 0;
+    tree_height = 0;
+}
 
-        root = new_root;
+void BPlusTree::evenLastLeaves(std::vector<NodePtr> &level, std::vector<float> &level_min)
+{
+    if (level.size() < 2)
         return;
-    }
 
-    // Find parent
-    NodePtr parent = findParent(left);
-    if (!parent)
+    // Move runs off the end of the second-to-last leaf until both hold about as many keys
+    BPlusNode &prev = *level[level.size() - 2];
+    BPlusNode &last = *level.back();
+    std::size_t from = prev.keyCount();
+    std::size_t items = last.header()->rid_count;
+    while (from - 1 >= last.keyCount() + (prev.keyCount() - from) + 1 &&
+           items + prev.runItems(from - 1) <= LEAF_RID_CAPACITY)
     {
-        std::cerr << "Error: Could not find parent node" << std::endl;
+        from--;
+        items += prev.runItems(from);
+    }
+    if (from == prev.keyCount())
+        return;
+
+    BPlusNode merged;
+    merged.init(NodeType::LEAF, last.header()->node_id);
+    merged.leafAppendRuns(prev, from, prev.keyCount());
+    merged.leafAppendRuns(last, 0, last.keyCount());
+    merged.header()->next = last.header()->next;
+    last = merged;
+    prev.leafTruncate(from);
+    level_min.back() = last.keys()[0];
+}
+
+void BPlusTree::bulkLoad(std::vector<std::pair<float, RecordRef>> &data, double fill_factor,
+                         WorkStealingPool *workers)
+{
+    // Clear existing tree
+    clearTree();
+
+    sortIndexEntries(data, workers);
+
+    std::size_t chunks = buildChunks(workers);
+    auto chunkBegin = [&chunks](std::size_t items, std::size_t chunk) { return items * chunk / chunks; };
+
+    // Start of every run of equal keys; each run becomes one leaf entry
+    std::vector<std::vector<std::size_t>> chunk_runs(chunks);
+    runTasks(workers, chunks, [&](std::size_t chunk) {
+        for (std::size_t i = chunkBegin(data.size(), chunk); i < chunkBegin(data.size(), chunk + 1); i++)
+            if (i == 0 || data[i].first != data[i - 1].first)
+                chunk_runs[chunk].push_back(i);
+    });
+
+    std::vector<std::size_t> runs;
+    for (const auto &starts : chunk_runs)
+        runs.insert(runs.end(), starts.begin(), starts.end());
+    std::size_t distinct_keys = runs.size();
+    runs.push_back(data.size());
+
+    if (distinct_keys == 0)
         return;
+
+    fill_factor = std::clamp(fill_factor, 0.0, 1.0);
+    std::size_t leaf_keys = std::max<std::size_t>(1, static_cast<std::size_t>(n * fill_factor));
+    std::size_t leaf_rids =
+        std::max<std::size_t>(INLINE_RUN_LIMIT, static_cast<std::size_t>(LEAF_RID_CAPACITY * fill_factor));
+    auto runLength = [&runs](std::size_t r) { return runs[r + 1] - runs[r]; };
+    auto runItems = [&runLength](std::size_t r) { return runLength(r) <= INLINE_RUN_LIMIT ? runLength(r) : 1; };
+
+    // Runs per leaf: as many as fit both the key array and the RID area
+    std::vector<std::size_t> bounds{0};
+    std::size_t keys_used = 0;
+    std::size_t items_used = 0;
+    for (std::size_t r = 0; r < distinct_keys; r++)
+    {
+        if (keys_used == leaf_keys || items_used + runItems(r) > leaf_rids)
+        {
+            bounds.push_back(r);
+            keys_used = 0;
+            items_used = 0;
+        }
+        keys_used++;
+        items_used += runItems(r);
     }
+    bounds.push_back(distinct_keys);
 
-    insertIntoInternal(parent, key, right->node_id);
+    // Leaf level, chained left to right, then the overflow chains of heavy runs
+    std::vector<NodePtr> level = createLevel(bounds.size() - 1, NodeType::LEAF);
+    std::vector<float> level_min(level.size()); // smallest key below each node of the level
 
-    // Check if parent needs splitting
-    if ((int)parent->keys.size() > n)
+    std::vector<std::size_t> overflow_start(distinct_keys + 1, 0);
+    for (std::size_t r = 0; r < distinct_keys; r++)
     {
-        auto [new_parent, promote_key] = splitInternalNode(parent);
-        insertIntoParent(parent, promote_key, new_parent);
+        std::size_t pages = runLength(r) > INLINE_RUN_LIMIT
+                                ? (runLength(r) + OVERFLOW_RID_CAPACITY - 1) / OVERFLOW_RID_CAPACITY
+                                : 0;
+        overflow_start[r + 1] = overflow_start[r] + pages;
     }
-}
+    std::vector<NodePtr> overflow = createLevel(overflow_start.back(), NodeType::OVERFLOW);
 
-NodePtr BPlusTree::findParent(NodePtr child)
-{
-    if (child->parent_id == 0)
-        return nullptr;
+    runTasks(workers, chunks, [&](std::size_t chunk) {
+        for (std::size_t g = chunkBegin(level.size(), chunk); g < chunkBegin(level.size(), chunk + 1); g++)
+        {
+            BPlusNode &leaf = *level[g];
+            for (std::size_t r = bounds[g]; r < bounds[g + 1]; r++)
+            {
+                float key = data[runs[r]].first;
+                if (runLength(r) <= INLINE_RUN_LIMIT)
+                {
+                    leaf.leafAppendKey(key);
+                    for (std::size_t i = runs[r]; i < runs[r + 1]; i++)
+                        leaf.leafAppendRid(data[i].second);
+                    continue;
+                }
+
+                std::size_t page = overflow_start[r];
+                for (std::size_t i = runs[r]; i < runs[r + 1]; i++)
+                {
+                    if (overflow[page]->freeRids() == 0)
+                    {
+                        overflow[page]->header()->next = overflow[page + 1]->header()->node_id;
+                        page++;
+                    }
+                    overflow[page]->overflowAppend(data[i].second);
+                }
+                leaf.leafAppendOverflowRun(key, overflow[overflow_start[r]]->header()->node_id);
+            }
+
+            if (g + 1 < level.size())
+                leaf.header()->next = level[g + 1]->header()->node_id;
+            level_min[g] = leaf.keys()[0];
+        }
+    });
 
-    auto it = nodes.find(child->parent_id);
-    return (it != nodes.end()) ? it->second : nullptr;
+    evenLastLeaves(level, level_min);
+    buildInternalLevels(level, level_min, fill_factor, workers);
 }
 
-void BPlusTree::bulkLoad(std::vector<std::pair<float, RecordRef>> &data)
+bool BPlusTree::bulkLoadSorted(const std::function<bool(IndexEntry &)> &next, double fill_factor,
+                               WorkStealingPool *workers)
 {
-    // Clear existing tree
-    nodes.clear();
-    root = nullptr;
-    next_node_id = 1;
+    clearTree();
+
+    fill_factor = std::clamp(fill_factor, 0.0, 1.0);
+    std::size_t leaf_keys = std::max<std::size_t>(1, static_cast<std::size_t>(n * fill_factor));
+    std::size_t leaf_rids =
+        std::max<std::size_t>(INLINE_RUN_LIMIT, static_cast<std::size_t>(LEAF_RID_CAPACITY * fill_factor));
+
+    // Leaves are filled as entries arrive, only the tree itself is held in memory. The current run
+    // keeps up to INLINE_RUN_LIMIT records aside; a longer one is streamed into overflow pages.
+    std::vector<NodePtr> level;
+    std::vector<float> level_min;
+    bool in_run = false;
+    float run_key = 0.0f;
+    std::vector<RecordRef> run_refs;
+    NodePtr run_head = nullptr;
+    NodePtr run_tail = nullptr;
+
+    auto addToRun = [&](const RecordRef &ref) {
+        if (!run_head && run_refs.size() < INLINE_RUN_LIMIT)
+        {
+            run_refs.push_back(ref);
+            return;
+        }
+        if (!run_head)
+        {
+            run_head = run_tail = createNode(NodeType::OVERFLOW);
+            for (const auto &buffered : run_refs)
+                run_tail->overflowAppend(buffered);
+            run_refs.clear();
+        }
+        if (run_tail->freeRids() == 0)
+        {
+            NodePtr page = createNode(NodeType::OVERFLOW);
+            run_tail->header()->next = page->header()->node_id;
+            run_tail = page;
+        }
+        run_tail->overflowAppend(ref);
+    };
 
-    // Sort data by key
-    std::sort(data.begin(), data.end());
+    auto placeRun = [&]() {
+        std::size_t items = run_head ? 1 : run_refs.size();
+        NodePtr leaf = level.empty() ? nullptr : level.back();
+        if (!leaf || leaf->keyCount() == leaf_keys || leaf->header()->rid_count + items > leaf_rids)
+        {
+            NodePtr fresh = createNode(NodeType::LEAF);
+            if (leaf)
+                leaf->header()->next = fresh->header()->node_id;
+            level.push_back(fresh);
+            level_min.push_back(run_key);
+            leaf = fresh;
+        }
 
-    std::cout << "Building B+ tree with " << data.size() << " records..." << std::endl;
+        if (run_head)
+        {
+            leaf->leafAppendOverflowRun(run_key, run_head->header()->node_id);
+        }
+        else
+        {
+            leaf->leafAppendKey(run_key);
+            for (const auto &ref : run_refs)
+                leaf->leafAppendRid(ref);
+        }
+        run_refs.clear();
+        run_head = run_tail = nullptr;
+    };
 
-    // Insert all records
-    for (size_t i = 0; i < data.size(); i++)
+    IndexEntry entry;
+    while (next(entry))
     {
-        insert(data[i].first, data[i].second);
-
-        // Progress indicator
-        if (i % 5000 == 0)
+        if (in_run && entry.first == run_key)
         {
-            std::cout << "Inserted " << i << " records..." << std::endl;
+            addToRun(entry.second);
+            continue;
         }
+        if (in_run && entry.first < run_key)
+        {
+            std::cerr << "bulkLoadSorted: keys out of order at " << entry.first << std::endl;
+            clearTree();
+            return false;
+        }
+
+        if (in_run)
+            placeRun();
+        in_run = true;
+        run_key = entry.first;
+        addToRun(entry.second);
     }
 
-    updateStatistics();
-    std::cout << "B+ tree construction completed." << std::endl;
+    if (!in_run)
+        return true;
+    placeRun();
+
+    // Even out the last two leaves so the final one is not left nearly empty
+    evenLastLeaves(level, level_min);
+
+    buildInternalLevels(level, level_min, fill_factor, workers);
+    return true;
+}
+
+void BPlusTree::buildInternalLevels(std::vector<NodePtr> &level, std::vector<float> &level_min, double fill_factor,
+                                    WorkStealingPool *workers)
+{
+    std::size_t fanout = std::max<std::size_t>(2, static_cast<std::size_t>(internal_n * fill_factor) + 1);
+    std::size_t chunks = buildChunks(workers);
+    auto chunkBegin = [&chunks](std::size_t items, std::size_t chunk) { return items * chunk / chunks; };
+
+    // One pass per level until a single node is left
+    tree_height = 1;
+    while (level.size() > 1)
+    {
+        std::vector<std::size_t> bounds = groupBounds(level.size(), fanout);
+        std::vector<NodePtr> parents = createLevel(bounds.size() - 1, NodeType::INTERNAL);
+        std::vector<float> parents_min(parents.size());
+
+        runTasks(workers, chunks, [&](std::size_t chunk) {
+            for (std::size_t g = chunkBegin(parents.size(), chunk); g < chunkBegin(parents.size(), chunk + 1); g++)
+            {
+                BPlusNode &internal = *parents[g];
+                for (std::size_t c = bounds[g]; c < bounds[g + 1]; c++)
+                {
+                    if (c > bounds[g])
+                        internal.keys()[internal.header()->key_count++] = level_min[c];
+                    internal.children()[c - bounds[g]] = level[c]->header()->node_id;
+                }
+                parents_min[g] = level_min[bounds[g]];
+            }
+        });
+
+        level = std::move(parents);
+        level_min = std::move(parents_min);
+        tree_height++;
+    }
+
+    NodePtr root = level.front();
+    root->header()->is_root = 1;
+    root_id = root->header()->node_id;
 }
 
 std::vector<RecordRef> BPlusTree::search(float key)
 {
-    if (!root)
+    if (root_id == 0)
         return {};
 
+    PinScope scope(*this);
     NodePtr leaf = findLeafNode(key);
+    if (!leaf)
+        return {};
 
     // Binary search in leaf node
-    auto it = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), key);
-
-    if (it != leaf->keys.end() && *it == key)
-    {
-        int index = it - leaf->keys.begin();
-        return leaf->values[index];
-    }
+    std::vector<RecordRef> result;
+    std::size_t pos = leaf->lowerBound(key);
+    if (pos < leaf->keyCount() && leaf->keys()[pos] == key)
+        collectRun(*leaf, pos, result);
 
-    return {};
+    return result;
 }
 
 /*
@@ -419,36 +922,34 @@ std::vector<RecordRef> BPlusTree::searchGreaterThan(float key)
 std::vector<RecordRef> BPlusTree::searchRange(float min_key, float max_key)
 {
     std::vector<RecordRef> result;
-    if (!root || min_key > max_key)
+    if (root_id == 0 || min_key > max_key)
         return result;
 
+    PinScope scope(*this);
+
     // Find the first leaf node that might contain keys >= min_key
     NodePtr leaf = findLeafNode(min_key);
+    std::size_t pos = leaf ? leaf->lowerBound(min_key) : 0;
 
     while (leaf)
     {
-        for (size_t i = 0; i < leaf->keys.size(); i++)
+        for (; pos < leaf->keyCount(); pos++)
         {
-            if (leaf->keys[i] >= min_key && leaf->keys[i] <= max_key)
-            {
-                // Add all records for this key
-                for (const auto &ref : leaf->values[i])
-                {
-                    result.push_back(ref);
-                }
-            }
-            else if (leaf->keys[i] > max_key)
-            {
-                // Since keys are sorted, we can stop here
+            // Since keys are sorted, we can stop here
+            if (leaf->keys()[pos] > max_key)
                 return result;
-            }
+
+            // Add all records for this key
+            collectRun(*leaf, pos, result);
         }
 
-        // Move to next leaf
-        if (leaf->next_leaf == 0)
+        // Move to next leaf, letting go of everything read so far
+        std::uint32_t next_leaf = leaf->header()->next;
+        if (next_leaf == 0)
             break;
-        auto next_it = nodes.find(leaf->next_leaf);
-        leaf = (next_it != nodes.end()) ? next_it->second : nullptr;
+        releasePins(scope.mark);
+        leaf = getNode(next_leaf);
+        pos = 0;
     }
 
     return result;
@@ -459,46 +960,38 @@ std::pair<std::vector<RecordRef>, int> BPlusTree::searchGreaterThanWithStats(flo
     std::vector<RecordRef> result;
     int nodes_accessed = 0;
 
-    if (!root)
+    if (root_id == 0)
         return {result, nodes_accessed};
 
+    PinScope scope(*this);
+
     // 1. Traverse to the first leaf node that could contain the key.
-    NodePtr current = root;
-    while (current && !current->is_leaf)
+    NodePtr current = getNode(root_id);
+    while (current && !current->isLeaf())
     {
         nodes_accessed++; // Count internal node access
-        int i = 0;
-        while (i < (int)current->keys.size() && key >= current->keys[i])
-        {
-            i++;
-        }
-        current = nodes.count(current->children[i]) ? nodes[current->children[i]] : nullptr;
+        current = getNode(current->children()[current->upperBound(key)]);
     }
 
     NodePtr leaf = current;
+    std::size_t pos = leaf ? leaf->upperBound(key) : 0;
 
-    // 2. Iterate from this leaf onwards.
+    // 2. Iterate from this leaf onwards; overflow pages of long duplicate runs count as accesses too.
     while (leaf)
     {
         nodes_accessed++; // Count leaf node access
-        for (size_t i = 0; i < leaf->keys.size(); i++)
-        {
-            if (leaf->keys[i] > key)
-            {
-                // Add all records for this key
-                for (const auto &ref : leaf->values[i])
-                {
-                    result.push_back(ref);
-                }
-            }
-        }
+        for (; pos < leaf->keyCount(); pos++)
+            collectRun(*leaf, pos, result, &nodes_accessed);
 
         // 3. Move to the next leaf.
-        if (leaf->next_leaf == 0)
+        std::uint32_t next_leaf = leaf->header()->next;
+        if (next_leaf == 0)
         {
             break; // End of list
         }
-        leaf = nodes.count(leaf->next_leaf) ? nodes[leaf->next_leaf] : nullptr;
+        releasePins(scope.mark);
+        leaf = getNode(next_leaf);
+        pos = 0;
     }
 
     return {result, nodes_accessed};
@@ -506,35 +999,89 @@ std::pair<std::vector<RecordRef>, int> BPlusTree::searchGreaterThanWithStats(flo
 
 bool BPlusTree::deleteKey(float key, const RecordRef &record_ref)
 {
-    if (!root)
+    if (root_id == 0)
         return false;
 
+    writeBackIfFull();
+    PinScope scope(*this);
     NodePtr leaf = findLeafNode(key);
+    if (!leaf)
+    {
+        std::cerr << "Cannot reach the leaf for key " << key << ", entry not deleted" << std::endl;
+        return false;
+    }
 
-    // Find the key in the leaf
-    auto it = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), key);
+    if (wal)
+    {
+        LogRecord entry;
+        entry.type = LogType::INDEX_DELETE;
+        entry.key = key;
+        entry.ref = record_ref;
+        wal->append(entry);
+    }
 
-    if (it == leaf->keys.end() || *it != key)
+    // Find the key in the leaf
+    std::size_t pos = leaf->lowerBound(key);
+    if (pos == leaf->keyCount() || leaf->keys()[pos] != key)
     {
         return false; // Key not found
     }
+    leaf = writable(leaf);
 
-    int index = it - leaf->keys.begin();
-
-    // Remove the specific record reference from the values
-    auto &value_list = leaf->values[index];
-    auto ref_it = std::find(value_list.begin(), value_list.end(), record_ref);
-
-    if (ref_it != value_list.end())
+    if (!leaf->isOverflowRun(pos))
     {
-        value_list.erase(ref_it);
+        // Remove the specific record reference from the run
+        const LeafSlot &slot = leaf->slots()[pos];
+        for (std::size_t i = 0; i < slot.count; i++)
+        {
+            if (leaf->rid(slot.offset + i) == record_ref)
+            {
+                leaf->leafRemoveRid(pos, i);
+                break;
+            }
+        }
+
+        // If this was the last reference for this key, remove the key
+        if (leaf->slots()[pos].count == 0)
+            leaf->leafRemoveKey(pos);
+        return true;
     }
 
-    // If this was the last reference for this key, remove the key
-    if (value_list.empty())
+    // Long run: find the page holding the reference and unlink the page once it is empty
+    std::size_t mark = pinMark();
+    std::uint32_t prev_id = 0;
+    std::uint32_t page_id = leaf->overflowHead(pos);
+    while (page_id != 0)
     {
-        leaf->keys.erase(leaf->keys.begin() + index);
-        leaf->values.erase(leaf->values.begin() + index);
+        NodePtr page = getNode(page_id);
+        if (!page)
+            break;
+
+        std::size_t i = 0;
+        while (i < page->header()->rid_count && !(page->rid(i) == record_ref))
+            i++;
+        if (i == page->header()->rid_count)
+        {
+            prev_id = page_id;
+            page_id = page->header()->next;
+            releasePins(mark);
+            continue;
+        }
+
+        page = writable(page);
+        page->overflowRemove(i);
+        if (page->header()->rid_count > 0)
+            break;
+
+        std::uint32_t rest = page->header()->next;
+        if (prev_id != 0)
+            writableNode(prev_id)->header()->next = rest;
+        else if (rest != 0)
+            leaf->setOverflowHead(pos, rest);
+        else
+            leaf->leafRemoveKey(pos);
+        freeNode(page);
+        break;
     }
 
     return true;
@@ -542,331 +1089,460 @@ bool BPlusTree::deleteKey(float key, const RecordRef &record_ref)
 
 int BPlusTree::deleteGreaterThan(float key)
 {
-    if (!root)
+    if (root_id == 0)
         return 0;
 
     int deleted_count = 0;
+    writeBackIfFull();
+    PinScope scope(*this);
 
     // Find the first leaf node that could contain the key
     NodePtr leaf = findLeafNode(key);
-
-    // Iterate through all leaves from this point
-    while (leaf)
+    if (!leaf)
     {
-        // Collect keys to delete from this leaf
-        std::vector<int> indices_to_delete;
+        std::cerr << "Cannot reach the leaf for key " << key << ", nothing deleted" << std::endl;
+        return 0;
+    }
 
-        for (size_t i = 0; i < leaf->keys.size(); i++)
-        {
-            if (leaf->keys[i] > key)
-            {
-                // Count all records for this key
-                deleted_count += leaf->values[i].size();
-                indices_to_delete.push_back(i);
-            }
-        }
+    if (wal)
+    {
+        LogRecord entry;
+        entry.type = LogType::INDEX_DELETE_GREATER;
+        entry.key = key;
+        wal->append(entry);
+    }
 
-        // Delete in reverse order to maintain indices
-        for (int i = indices_to_delete.size() - 1; i >= 0; i--)
+    // Iterate through all leaves from this point; keys above key sit at the end of each leaf
+    while (leaf)
+    {
+        std::size_t keep = leaf->upperBound(key);
+        if (keep < leaf->keyCount())
         {
-            int idx = indices_to_delete[i];
-            leaf->keys.erase(leaf->keys.begin() + idx);
-            leaf->values.erase(leaf->values.begin() + idx);
+            leaf = writable(leaf);
+            for (std::size_t i = keep; i < leaf->keyCount(); i++)
+                deleted_count += freeRun(*leaf, i);
+            leaf->leafTruncate(keep);
         }
 
         // Move to next leaf
-        if (leaf->next_leaf == 0)
+        std::uint32_t next_leaf = leaf->header()->next;
+        if (next_leaf == 0)
         {
             break;
         }
-        auto next_it = nodes.find(leaf->next_leaf);
-        leaf = (next_it != nodes.end()) ? next_it->second : nullptr;
+        releasePins(scope.mark);
+
+        // Every leaf done so far is a finished step: the logged operation redoes the rest after a crash
+        if (wal)
+            writeBackIfFull();
+        leaf = getNode(next_leaf);
+        if (!leaf)
+            std::cerr << "Cannot reach leaf " << next_leaf << ", later keys above " << key << " were kept"
+                      << std::endl;
     }
 
-    // Update tree statistics
-    updateStatistics();
-
     return deleted_count;
 }
 
 std::vector<float> BPlusTree::getRootKeys() const
 {
+    PinScope scope(*this);
+    NodePtr root = getNode(root_id);
     if (!root)
         return {};
-    return root->keys;
+    return std::vector<float>(root->keys(), root->keys() + root->keyCount());
 }
 
-void BPlusTree::updateStatistics()
+void BPlusTree::printStatistics()
 {
-    if (!root)
+    std::cout << "=== B+ Tree Statistics ===" << std::endl;
+    std::cout << "Parameter n: " << n << " keys per leaf, " << internal_n << " per internal node (" << BLOCK_SIZE
+              << "-byte pages)" << std::endl;
+    std::cout << "Number of nodes: " << total_nodes << std::endl;
+    std::cout << "Overflow pages: " << overflow_pages << std::endl;
+    std::cout << "Number of levels: " << tree_height << std::endl;
+
+    std::cout << "Root node keys: ";
+    auto root_keys = getRootKeys();
+    if (root_keys.empty())
     {
-        total_nodes = 0;
-        tree_height = 0;
-        return;
+        std::cout << "(empty tree)";
+    }
+    else
+    {
+        for (size_t i = 0; i < root_keys.size(); i++)
+        {
+            if (i > 0)
+                std::cout << ", ";
+            std::cout << root_keys[i];
+        }
     }
+    std::cout << std::endl;
 
-    total_nodes = 0;
-    countNodes(root, total_nodes);
-    tree_height = calculateHeight(root);
+    if (cache)
+    {
+        std::cout << "Node cache: " << cache->getNumFrames() << " pages, " << cache->getReads()
+                  << " read from disk, " << cache->getHits() << " hits, " << write_backs
+                  << " early write-backs of modified pages" << std::endl;
+    }
 }
 
-void BPlusTree::countNodes(NodePtr node, int &count)
+void BPlusTree::encodeHeaderPage(char *page, std::vector<BPlusNode> &free_list_pages) const
 {
-    if (!node)
-        return;
-
-    count++;
-
-    if (!node->is_leaf)
+    IndexFileHeader header{INDEX_FILE_MAGIC,
+                           INDEX_FILE_VERSION,
+                           static_cast<std::uint32_t>(BLOCK_SIZE),
+                           static_cast<std::uint32_t>(n),
+                           static_cast<std::uint32_t>(internal_n),
+                           root_id,
+                           next_node_id,
+                           static_cast<std::uint32_t>(total_nodes),
+                           static_cast<std::uint32_t>(overflow_pages),
+                           static_cast<std::uint32_t>(tree_height),
+                           0,
+                           0};
+    header.free_count = static_cast<std::uint32_t>(std::min(free_ids.size(), MAX_HEADER_FREE_IDS));
+
+    // The rest are chained through some of those free pages, each listing the ids below it in free_ids
+    free_list_pages.clear();
+    for (std::size_t end = free_ids.size(); end > header.free_count;)
     {
-        for (auto child_id : node->children)
-        {
-            auto child_it = nodes.find(child_id);
-            if (child_it != nodes.end())
-            {
-                countNodes(child_it->second, count);
-            }
-        }
+        BPlusNode &list_page = free_list_pages.emplace_back();
+        list_page.init(NodeType::FREE_LIST, free_ids[--end]);
+        std::size_t count = std::min<std::size_t>(end - header.free_count, FREE_LIST_CAPACITY);
+        std::memcpy(list_page.freeIds(), free_ids.data() + end - count, count * sizeof(std::uint32_t));
+        list_page.header()->key_count = static_cast<std::uint16_t>(count);
+        list_page.header()->next = header.free_list_head;
+        header.free_list_head = list_page.header()->node_id;
+        end -= count;
     }
+
+    std::memset(page, 0, BLOCK_SIZE);
+    std::memcpy(page, &header, sizeof(header));
+    if (header.free_count > 0)
+        std::memcpy(page + sizeof(header), free_ids.data(), header.free_count * sizeof(std::uint32_t));
 }
 
-int BPlusTree::calculateHeight(NodePtr node)
+std::string BPlusTree::journalFilename() const
 {
-    if (!node)
-        return 0;
+    return index_filename + ".journal";
+}
 
-    if (node->is_leaf)
+bool BPlusTree::saveToDisk()
+{
+    // Disk-resident: only the pages changed since opening go back
+    if (cache)
     {
-        return 1;
+        std::size_t written = savePagesInPlace();
+        if (written > 0)
+            std::cout << "B+ tree saved to disk: " << index_filename << " (" << written << " pages written)"
+                      << std::endl;
+        return written > 0;
     }
 
-    // For internal nodes, recurse to first child
-    if (!node->children.empty())
+    // The whole file is replaced, so a save cut short earlier must not be finished on top of it later
+    if (!recoverJournal())
+        return false;
+
+    // A crash mid-save must leave the previous index intact
+    std::string temp_filename = index_filename + ".tmp";
+    std::ofstream file(temp_filename, std::ios::binary);
+    if (!file.is_open())
     {
-        auto child_it = nodes.find(node->children[0]);
-        if (child_it != nodes.end())
-        {
-            return 1 + calculateHeight(child_it->second);
-        }
+        std::cerr << "Failed to open index file for writing: " << temp_filename << std::endl;
+        return false;
     }
 
-    return 1;
-}
+    // Header page
+    BPlusNode page;
+    std::vector<BPlusNode> free_list_pages;
+    encodeHeaderPage(page.data, free_list_pages);
+    file.write(page.data, BLOCK_SIZE);
 
-void BPlusTree::printStatistics()
-{
-    updateStatistics();
-
-    std::cout << "=== B+ Tree Statistics ===" << std::endl;
-    std::cout << "Parameter n: " << n << std::endl;
-    std::cout << "Number of nodes: " << total_nodes << std::endl;
-    std::cout << "Number of levels: " << tree_height << std::endl;
+    // Node id k at page k; freed ids leave zero pages behind, except those carrying the free list
+    std::memset(page.data, 0, BLOCK_SIZE);
+    for (std::uint32_t id = 1; id < next_node_id; id++)
+    {
+        NodePtr node = getNode(id);
+        file.write(node ? node->data : page.data, BLOCK_SIZE);
+    }
+    for (const auto &list_page : free_list_pages)
+    {
+        file.seekp(static_cast<std::streamoff>(list_page.header()->node_id) * BLOCK_SIZE);
+        file.write(list_page.data, BLOCK_SIZE);
+    }
 
-    std::cout << "Root node keys: ";
-    auto root_keys = getRootKeys();
-    if (root_keys.empty())
+    file.close();
+    if (!file)
     {
-        std::cout << "(empty tree)";
+        std::cerr << "Failed to write index file: " << temp_filename << std::endl;
+        return false;
     }
-    else
+
+    if (!replaceFileDurably(temp_filename, index_filename))
     {
-        for (size_t i = 0; i < root_keys.size(); i++)
-        {
-            if (i > 0)
-                std::cout << ", ";
-            std::cout << root_keys[i];
-        }
+        std::cerr << "Failed to replace index file: " << index_filename << std::endl;
+        return false;
     }
-    std::cout << std::endl;
+
+    std::cout << "B+ tree saved to disk: " << index_filename << std::endl;
+    return true;
 }
 
-void BPlusTree::saveToDisk()
+std::size_t BPlusTree::savePagesInPlace()
 {
-    updateStatistics();
+    // The header, every page changed or created since opening, and freed pages as zero pages
+    BPlusNode header_page;
+    BPlusNode zero_page;
+    std::vector<BPlusNode> free_list_pages;
+    encodeHeaderPage(header_page.data, free_list_pages);
+    std::memset(zero_page.data, 0, BLOCK_SIZE);
+
+    std::vector<std::pair<std::uint32_t, const char *>> pages{{0, header_page.data}};
+    nodes.forEach([&pages](std::uint32_t node_id, const BPlusNode &node) { pages.push_back({node_id, node.data}); });
+    for (std::uint32_t node_id : free_ids)
+        pages.push_back({node_id, zero_page.data});
+    // Written after the zero pages, so the free-list pages among them win
+    for (const auto &list_page : free_list_pages)
+        pages.push_back({list_page.header()->node_id, list_page.data});
+
+    // 1. The page images go to the journal, which only takes effect once it is complete and renamed
+    std::string journal = journalFilename();
+    std::string temp_journal = journal + ".tmp";
+    std::ofstream out(temp_journal, std::ios::binary);
+    for (const auto &[node_id, data] : pages)
+    {
+        out.write(reinterpret_cast<const char *>(&node_id), sizeof(node_id));
+        out.write(data, BLOCK_SIZE);
+    }
+    std::uint32_t trailer[2] = {JOURNAL_MAGIC, static_cast<std::uint32_t>(pages.size())};
+    out.write(reinterpret_cast<const char *>(trailer), sizeof(trailer));
+    out.close();
 
-    std::ofstream file(index_filename, std::ios::binary);
-    if (!file.is_open())
+    if (!out || !replaceFileDurably(temp_journal, journal))
     {
-        std::cerr << "Failed to open index file for writing: " << index_filename << std::endl;
-        return;
+        std::cerr << "Failed to write index journal: " << journal << std::endl;
+        return 0;
     }
 
-    // Write file header
-    uint32_t magic = 0x42504c55; // "BPLU" magic number
-    file.write(reinterpret_cast<const char *>(&magic), sizeof(magic));
-    file.write(reinterpret_cast<const char *>(&n), sizeof(n));
-    file.write(reinterpret_cast<const char *>(&total_nodes), sizeof(total_nodes));
-    file.write(reinterpret_cast<const char *>(&tree_height), sizeof(tree_height));
-    file.write(reinterpret_cast<const char *>(&next_node_id), sizeof(next_node_id));
+    // 2. Write them in place; from here on a crash is repaired by replaying the journal
+    int fd = ::open(index_filename.c_str(), O_WRONLY);
+    bool ok = fd >= 0;
+    for (std::size_t i = 0; ok && i < pages.size(); i++)
+        ok = ::pwrite(fd, pages[i].second, BLOCK_SIZE, static_cast<off_t>(pages[i].first) * BLOCK_SIZE) ==
+             static_cast<ssize_t>(BLOCK_SIZE);
+    ok = fd >= 0 && syncAndClose(fd) && ok;
+    if (!ok)
+    {
+        std::cerr << "Failed to write index pages, the journal is kept: " << index_filename << std::endl;
+        return 0;
+    }
+    std::remove(journal.c_str());
+
+    // 3. The file is current again: drop the modified copies and the cached pages they replaced
+    nodes.clear();
+    cache->reset();
+    return pages.size();
+}
+
+void BPlusTree::writeBackIfFull()
+{
+    if (!cache || nodes.size() < cache->getNumFrames())
+        return;
 
-    uint32_t root_id = root ? root->node_id : 0;
-    file.write(reinterpret_cast<const char *>(&root_id), sizeof(root_id));
+    // Like data blocks, no page goes out ahead of the log records of the changes it holds
+    if (wal && !wal->commitAll())
+        return;
+    if (savePagesInPlace() > 0)
+        write_backs++;
+}
+
+bool BPlusTree::recoverJournal()
+{
+    std::string journal = journalFilename();
+    std::ifstream in(journal, std::ios::binary | std::ios::ate);
+    if (!in.is_open())
+        return true;
+
+    // Only a complete journal is ever renamed into place, but check before trusting it
+    const std::size_t record_size = sizeof(std::uint32_t) + BLOCK_SIZE;
+    std::uint32_t trailer[2] = {0, 0};
+    std::size_t size = static_cast<std::size_t>(in.tellg());
+    if (size >= sizeof(trailer))
+    {
+        in.seekg(static_cast<std::streamoff>(size - sizeof(trailer)));
+        in.read(reinterpret_cast<char *>(trailer), sizeof(trailer));
+    }
+    if (!in || trailer[0] != JOURNAL_MAGIC || (size - sizeof(trailer)) != trailer[1] * record_size)
+    {
+        std::cerr << "Discarding damaged index journal: " << journal << std::endl;
+        std::remove(journal.c_str());
+        return true;
+    }
 
-    // Write all nodes
-    for (const auto &[id, node] : nodes)
+    int fd = ::open(index_filename.c_str(), O_WRONLY);
+    bool ok = fd >= 0;
+    BPlusNode page;
+    in.seekg(0);
+    for (std::uint32_t i = 0; ok && i < trailer[1]; i++)
     {
-        saveNodeToDisk(file, node);
+        std::uint32_t node_id;
+        in.read(reinterpret_cast<char *>(&node_id), sizeof(node_id));
+        in.read(page.data, BLOCK_SIZE);
+        ok = in && ::pwrite(fd, page.data, BLOCK_SIZE, static_cast<off_t>(node_id) * BLOCK_SIZE) ==
+                       static_cast<ssize_t>(BLOCK_SIZE);
+    }
+    ok = fd >= 0 && syncAndClose(fd) && ok;
+    if (!ok)
+    {
+        std::cerr << "Failed to replay index journal: " << journal << std::endl;
+        return false;
     }
 
-    file.close();
-    std::cout << "B+ tree saved to disk: " << index_filename << std::endl;
+    std::remove(journal.c_str());
+    std::cout << "Finished an interrupted index save from " << journal << std::endl;
+    return true;
 }
 
-void BPlusTree::loadFromDisk()
+bool BPlusTree::loadFromDisk()
 {
+    if (!recoverJournal())
+        return false;
+
     std::ifstream file(index_filename, std::ios::binary);
     if (!file.is_open())
     {
         std::cout << "Index file not found, will create new index: " << index_filename << std::endl;
-        return;
+        return false;
     }
 
     // Read and verify header
-    uint32_t magic;
-    file.read(reinterpret_cast<char *>(&magic), sizeof(magic));
-    if (magic != 0x42504c55)
+    BPlusNode page;
+    IndexFileHeader header{};
+    std::vector<std::uint32_t> header_free_ids;
+    if (!file.read(page.data, BLOCK_SIZE) || !decodeHeaderPage(page.data, header, header_free_ids))
     {
         std::cerr << "Invalid index file format" << std::endl;
-        file.close();
-        return;
+        return false;
     }
 
-    file.read(reinterpret_cast<char *>(&n), sizeof(n));
-    file.read(reinterpret_cast<char *>(&total_nodes), sizeof(total_nodes));
-    file.read(reinterpret_cast<char *>(&tree_height), sizeof(tree_height));
-    file.read(reinterpret_cast<char *>(&next_node_id), sizeof(next_node_id));
-
-    uint32_t root_id;
-    file.read(reinterpret_cast<char *>(&root_id), sizeof(root_id));
-
     // Clear existing nodes
-    nodes.clear();
-    root = nullptr;
+    clearTree();
 
-    // Load all nodes
-    for (int i = 0; i < total_nodes; i++)
+    // Load all pages, each straight into its arena slot; the free list is rebuilt from the pages
+    for (std::uint32_t id = 1; id < header.next_node_id; id++)
     {
-        auto node = loadNodeFromDisk(file);
-        if (node)
+        NodePtr node = nodes.allocate(id);
+        if (!file.read(node->data, BLOCK_SIZE) ||
+            (!node->isFree() && node->header()->node_id != id))
         {
-            nodes[node->node_id] = node;
-            if (node->node_id == root_id)
-            {
-                root = node;
-            }
+            std::cerr << "Corrupt index file at page " << id << ": " << index_filename << std::endl;
+            clearTree();
+            return false;
+        }
+
+        if (node->isFree())
+        {
+            nodes.release(id);
+            free_ids.push_back(id);
+        }
+        else if (node->header()->type == NodeType::OVERFLOW)
+        {
+            overflow_pages++;
+        }
+        else
+        {
+            total_nodes++;
         }
     }
 
+    n = static_cast<int>(header.leaf_keys);
+    internal_n = static_cast<int>(header.internal_keys);
+    next_node_id = header.next_node_id;
+    root_id = header.root_id;
+    tree_height = static_cast<int>(header.tree_height);
+
     file.close();
     std::cout << "B+ tree loaded from disk: " << index_filename << std::endl;
     printStatistics();
+    return true;
 }
 
-void BPlusTree::saveNodeToDisk(std::ofstream &file, NodePtr node)
+bool BPlusTree::openFromDisk(std::size_t cache_nodes)
 {
-    if (!node)
-        return;
-
-    // Write node header
-    file.write(reinterpret_cast<const char *>(&node->is_leaf), sizeof(node->is_leaf));
-    file.write(reinterpret_cast<const char *>(&node->is_root), sizeof(node->is_root));
-    file.write(reinterpret_cast<const char *>(&node->node_id), sizeof(node->node_id));
-    file.write(reinterpret_cast<const char *>(&node->parent_id), sizeof(node->parent_id));
-
-    uint32_t num_keys = node->keys.size();
-    file.write(reinterpret_cast<const char *>(&num_keys), sizeof(num_keys));
+    if (!recoverJournal())
+        return false;
 
-    // Write keys
-    for (const auto &key : node->keys)
+    std::ifstream file(index_filename, std::ios::binary);
+    if (!file.is_open())
     {
-        file.write(reinterpret_cast<const char *>(&key), sizeof(float));
+        std::cout << "Index file not found, will create new index: " << index_filename << std::endl;
+        return false;
     }
 
-    if (!node->is_leaf)
+    // The header page is all that is read up front
+    BPlusNode page;
+    IndexFileHeader header{};
+    std::vector<std::uint32_t> header_free_ids;
+    if (!file.read(page.data, BLOCK_SIZE) || !decodeHeaderPage(page.data, header, header_free_ids))
     {
-        // Write children
-        uint32_t num_children = node->children.size();
-        file.write(reinterpret_cast<const char *>(&num_children), sizeof(num_children));
-        for (auto child_id : node->children)
-        {
-            file.write(reinterpret_cast<const char *>(&child_id), sizeof(child_id));
-        }
+        std::cerr << "Invalid index file format" << std::endl;
+        return false;
     }
-    else
+    if (!readFreeList(file, header.free_list_head, header.next_node_id, header_free_ids))
     {
-        // Leaf node - write values and next pointer
-        file.write(reinterpret_cast<const char *>(&node->next_leaf), sizeof(node->next_leaf));
-
-        // Write values
-        for (const auto &value_list : node->values)
-        {
-            uint32_t value_count = value_list.size();
-            file.write(reinterpret_cast<const char *>(&value_count), sizeof(value_count));
-            for (const auto &ref : value_list)
-            {
-                file.write(reinterpret_cast<const char *>(&ref.block_id), sizeof(ref.block_id));
-                file.write(reinterpret_cast<const char *>(&ref.record_offset), sizeof(ref.record_offset));
-            }
-        }
+        std::cerr << "Corrupt free-page list in index file: " << index_filename << std::endl;
+        return false;
     }
+    file.close();
+
+    clearTree();
+    n = static_cast<int>(header.leaf_keys);
+    internal_n = static_cast<int>(header.internal_keys);
+    next_node_id = header.next_node_id;
+    root_id = header.root_id;
+    total_nodes = static_cast<int>(header.total_nodes);
+    overflow_pages = static_cast<int>(header.overflow_pages);
+    tree_height = static_cast<int>(header.tree_height);
+    free_ids = std::move(header_free_ids);
+    cache = std::make_unique<BufferPool>(index_filename, std::max(cache_nodes, MIN_INDEX_CACHE_NODES));
+
+    std::cout << "B+ tree opened from disk: " << index_filename << std::endl;
+    printStatistics();
+    return true;
 }
 
-NodePtr BPlusTree::loadNodeFromDisk(std::ifstream &file)
+bool BPlusTree::freeze(const std::string &snapshot_filename)
 {
-    bool is_leaf, is_root;
-    uint32_t node_id, parent_id, num_keys;
-
-    // Read node header
-    file.read(reinterpret_cast<char *>(&is_leaf), sizeof(is_leaf));
-    file.read(reinterpret_cast<char *>(&is_root), sizeof(is_root));
-    file.read(reinterpret_cast<char *>(&node_id), sizeof(node_id));
-    file.read(reinterpret_cast<char *>(&parent_id), sizeof(parent_id));
-    file.read(reinterpret_cast<char *>(&num_keys), sizeof(num_keys));
-
-    // Create node
-    auto node = std::make_shared<BPlusNode>(is_leaf);
-    node->is_root = is_root;
-    node->node_id = node_id;
-    node->parent_id = parent_id;
+    std::vector<IndexEntry> entries;
 
-    // Read keys
-    node->keys.resize(num_keys);
-    for (uint32_t i = 0; i < num_keys; i++)
-    {
-        file.read(reinterpret_cast<char *>(&node->keys[i]), sizeof(float));
-    }
+    // Leftmost leaf, then along the leaf chain
+    PinScope scope(*this);
+    NodePtr leaf = getNode(root_id);
+    while (leaf && !leaf->isLeaf())
+        leaf = getNode(leaf->children()[0]);
 
-    if (!is_leaf)
+    std::vector<RecordRef> run;
+    while (leaf)
     {
-        // Read children
-        uint32_t num_children;
-        file.read(reinterpret_cast<char *>(&num_children), sizeof(num_children));
-        node->children.resize(num_children);
-        for (uint32_t i = 0; i < num_children; i++)
+        for (std::size_t pos = 0; pos < leaf->keyCount(); pos++)
         {
-            file.read(reinterpret_cast<char *>(&node->children[i]), sizeof(uint32_t));
+            run.clear();
+            collectRun(*leaf, pos, run);
+            for (const RecordRef &ref : run)
+                entries.push_back({leaf->keys()[pos], ref});
         }
-    }
-    else
-    {
-        // Leaf node - read values and next pointer
-        file.read(reinterpret_cast<char *>(&node->next_leaf), sizeof(node->next_leaf));
 
-        // Read values
-        node->values.resize(num_keys);
-        for (uint32_t i = 0; i < num_keys; i++)
-        {
-            uint32_t value_count;
-            file.read(reinterpret_cast<char *>(&value_count), sizeof(value_count));
-            node->values[i].resize(value_count);
-            for (uint32_t j = 0; j < value_count; j++)
-            {
-                file.read(reinterpret_cast<char *>(&node->values[i][j].block_id), sizeof(node->values[i][j].block_id));
-                file.read(reinterpret_cast<char *>(&node->values[i][j].record_offset),
-                          sizeof(node->values[i][j].record_offset));
-            }
-        }
+        std::uint32_t next_leaf = leaf->header()->next;
+        if (next_leaf == 0)
+            break;
+        releasePins(scope.mark);
+        leaf = getNode(next_leaf);
     }
 
-    return node;
+    if (!IndexSnapshot::write(snapshot_filename, entries))
+        return false;
+    std::cout << "B+ tree frozen into snapshot: " << snapshot_filename << " (" << entries.size() << " entries)"
+              << std::endl;
+    return true;
 }
@@ -0,0 +1,550 @@
+#include "buffer_pool.h"
+#include "constants.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+namespace
+{
+
+// Least recently used unpinned frame goes first
+class LRUReplacer : public Replacer
+{
+  private:
+    std::list<std::size_t> order; // front = most recently used
+    std::vector<std::list<std::size_t>::iterator> position;
+    std::vector<bool> present;
+    std::vector<bool> evictable;
+
+  public:
+    explicit LRUReplacer(std::size_t num_frames)
+        : position(num_frames), present(num_frames, false), evictable(num_frames, false)
+    {
+    }
+
+    void recordAccess(std::size_t frame_id, std::uint32_t, bool) override
+    {
+        if (present[frame_id])
+            order.erase(position[frame_id]);
+        order.push_front(frame_id);
+        position[frame_id] = order.begin();
+        present[frame_id] = true;
+    }
+
+    void setEvictable(std::size_t frame_id, bool value) override
+    {
+        evictable[frame_id] = value;
+    }
+
+    bool victim(std::size_t &frame_id) override
+    {
+        for (auto it = order.rbegin(); it != order.rend(); ++it)
+        {
+            if (evictable[*it])
+            {
+                frame_id = *it;
+                remove(frame_id);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Most recently used, so the next victim is another frame
+    void restore(std::size_t frame_id, std::uint32_t block_id) override
+    {
+        recordAccess(frame_id, block_id, true);
+        evictable[frame_id] = true;
+    }
+
+    void remove(std::size_t frame_id) override
+    {
+        if (!present[frame_id])
+            return;
+        order.erase(position[frame_id]);
+        present[frame_id] = false;
+        evictable[frame_id] = false;
+    }
+};
+
+// Second-chance sweep over the frames, one reference bit per frame
+class ClockReplacer : public Replacer
+{
+  private:
+    std::vector<bool> present;
+    std::vector<bool> referenced;
+    std::vector<bool> evictable;
+    std::size_t hand;
+
+  public:
+    explicit ClockReplacer(std::size_t num_frames)
+        : present(num_frames, false), referenced(num_frames, false), evictable(num_frames, false), hand(0)
+    {
+    }
+
+    void recordAccess(std::size_t frame_id, std::uint32_t, bool) override
+    {
+        present[frame_id] = true;
+        referenced[frame_id] = true;
+    }
+
+    void setEvictable(std::size_t frame_id, bool value) override
+    {
+        evictable[frame_id] = value;
+    }
+
+    bool victim(std::size_t &frame_id) override
+    {
+        std::size_t num_frames = present.size();
+
+        // Two full sweeps clear every reference bit, so a third is never needed
+        for (std::size_t step = 0; step < 2 * num_frames + 1; step++)
+        {
+            std::size_t current = hand;
+            hand = (hand + 1) % num_frames;
+
+            if (!present[current] || !evictable[current])
+                continue;
+
+            if (referenced[current])
+            {
+                referenced[current] = false;
+                continue;
+            }
+
+            frame_id = current;
+            remove(frame_id);
+            return true;
+        }
+        return false;
+    }
+
+    void restore(std::size_t frame_id, std::uint32_t block_id) override
+    {
+        recordAccess(frame_id, block_id, true);
+        evictable[frame_id] = true;
+    }
+
+    void remove(std::size_t frame_id) override
+    {
+        present[frame_id] = false;
+        referenced[frame_id] = false;
+        evictable[frame_id] = false;
+    }
+};
+
+// Simplified 2Q (Johnson & Shasha): blocks seen once live in a FIFO (A1in) and are
+// only promoted to the LRU queue (Am) if they come back while remembered in A1out.
+class TwoQueueReplacer : public Replacer
+{
+  private:
+    enum class Queue
+    {
+        NONE,
+        A1IN,
+        AM
+    };
+
+    std::list<std::size_t> a1in; // front = newest
+    std::list<std::size_t> am;   // front = most recently used
+    std::list<std::uint32_t> a1out;
+    std::unordered_set<std::uint32_t> a1outSet;
+
+    std::vector<Queue> queue;
+    std::vector<std::list<std::size_t>::iterator> position;
+    std::vector<std::uint32_t> blockOf;
+    std::vector<bool> evictable;
+
+    std::size_t kin;
+    std::size_t kout;
+
+    void remember(std::uint32_t block_id)
+    {
+        a1out.push_front(block_id);
+        a1outSet.insert(block_id);
+        if (a1out.size() > kout)
+        {
+            a1outSet.erase(a1out.back());
+            a1out.pop_back();
+        }
+    }
+
+    bool evictFrom(std::list<std::size_t> &list, std::size_t &frame_id)
+    {
+        for (auto it = list.rbegin(); it != list.rend(); ++it)
+        {
+            if (evictable[*it])
+            {
+                frame_id = *it;
+                return true;
+            }
+        }
+        return false;
+    }
+
+  public:
+    explicit TwoQueueReplacer(std::size_t num_frames)
+        : queue(num_frames, Queue::NONE), position(num_frames), blockOf(num_frames, 0),
+          evictable(num_frames, false), kin(std::max<std::size_t>(1, num_frames / 4)),
+          kout(std::max<std::size_t>(1, num_frames / 2))
+    {
+    }
+
+    void recordAccess(std::size_t frame_id, std::uint32_t block_id, bool hit) override
+    {
+        blockOf[frame_id] = block_id;
+
+        if (hit)
+        {
+            // Hits inside A1in are deliberately ignored, that is what filters one-off scans
+            if (queue[frame_id] == Queue::AM)
+            {
+                am.erase(position[frame_id]);
+                am.push_front(frame_id);
+                position[frame_id] = am.begin();
+            }
+            return;
+        }
+
+        remove(frame_id);
+
+        auto ghost = a1outSet.find(block_id);
+        if (ghost != a1outSet.end())
+        {
+            a1outSet.erase(ghost);
+            a1out.remove(block_id);
+            am.push_front(frame_id);
+            position[frame_id] = am.begin();
+            queue[frame_id] = Queue::AM;
+        }
+        else
+        {
+            a1in.push_front(frame_id);
+            position[frame_id] = a1in.begin();
+            queue[frame_id] = Queue::A1IN;
+        }
+    }
+
+    void setEvictable(std::size_t frame_id, bool value) override
+    {
+        evictable[frame_id] = value;
+    }
+
+    bool victim(std::size_t &frame_id) override
+    {
+        bool found = false;
+
+        if (a1in.size() > kin)
+            found = evictFrom(a1in, frame_id);
+        if (!found)
+            found = evictFrom(am, frame_id);
+        if (!found)
+            found = evictFrom(a1in, frame_id);
+        if (!found)
+            return false;
+
+        if (queue[frame_id] == Queue::A1IN)
+            remember(blockOf[frame_id]);
+        remove(frame_id);
+        return true;
+    }
+
+    // victim() already took the frame out of its queue, and a hit would not put it back: the frame
+    // goes straight to the front of Am, and the ghost entry its eviction left in A1out is dropped
+    void restore(std::size_t frame_id, std::uint32_t block_id) override
+    {
+        if (a1outSet.erase(block_id) > 0)
+            a1out.remove(block_id);
+
+        blockOf[frame_id] = block_id;
+        am.push_front(frame_id);
+        position[frame_id] = am.begin();
+        queue[frame_id] = Queue::AM;
+        evictable[frame_id] = true;
+    }
+
+    void remove(std::size_t frame_id) override
+    {
+        if (queue[frame_id] == Queue::A1IN)
+            a1in.erase(position[frame_id]);
+        else if (queue[frame_id] == Queue::AM)
+            am.erase(position[frame_id]);
+
+        queue[frame_id] = Queue::NONE;
+        evictable[frame_id] = false;
+    }
+};
+
+} // namespace
+
+std::unique_ptr<Replacer> makeReplacer(ReplacementPolicy policy, std::size_t num_frames)
+{
+    switch (policy)
+    {
+    case ReplacementPolicy::CLOCK:
+        return std::make_unique<ClockReplacer>(num_frames);
+    case ReplacementPolicy::TWO_Q:
+        return std::make_unique<TwoQueueReplacer>(num_frames);
+    case ReplacementPolicy::LRU:
+    default:
+        return std::make_unique<LRUReplacer>(num_frames);
+    }
+}
+
+BufferPool::BufferPool(const std::string &filename, std::size_t num_frames, ReplacementPolicy policy)
+    : filename{filename}, fd{-1}, frames(num_frames == 0 ? 1 : num_frames), policy{policy}, hits{0}, misses{0},
+      reads{0}, writes{0}
+{
+    replacer = makeReplacer(policy, frames.size());
+
+    freeFrames.reserve(frames.size());
+    for (std::size_t i = frames.size(); i > 0; i--)
+        freeFrames.push_back(i - 1);
+}
+
+BufferPool::~BufferPool()
+{
+    flushAll();
+    if (fd >= 0)
+        ::close(fd);
+}
+
+bool BufferPool::openFile()
+{
+    if (fd >= 0)
+        return true;
+
+    fd = ::open(filename.c_str(), O_RDWR);
+    if (fd < 0)
+    {
+        std::cerr << "Cannot open database file: " << filename << '\n';
+        return false;
+    }
+    return true;
+}
+
+bool BufferPool::readBlock(std::uint32_t block_id, Block &block)
+{
+    if (!openFile())
+        return false;
+
+    ssize_t n = ::pread(fd, block.data, BLOCK_SIZE, static_cast<off_t>(block_id) * BLOCK_SIZE);
+    if (n <= 0)
+        return false;
+
+    // A short final block is padded as if it had been written in full
+    if (static_cast<std::size_t>(n) < BLOCK_SIZE)
+        std::memset(block.data + n, 0, BLOCK_SIZE - n);
+
+    reads++;
+    return true;
+}
+
+bool BufferPool::writeBlock(std::uint32_t block_id, const Block &block)
+{
+    if (!openFile())
+        return false;
+
+    if (writeBackHook && !writeBackHook())
+    {
+        std::cerr << "Write-back of block " << block_id << " held back, its log records are not durable" << '\n';
+        return false;
+    }
+
+    ssize_t n = ::pwrite(fd, block.data, BLOCK_SIZE, static_cast<off_t>(block_id) * BLOCK_SIZE);
+    if (n != static_cast<ssize_t>(BLOCK_SIZE))
+    {
+        std::cerr << "Failed to write block " << block_id << " to " << filename << '\n';
+        return false;
+    }
+
+    writes++;
+    return true;
+}
+
+bool BufferPool::acquireFrame(std::size_t &frame_id)
+{
+    if (!freeFrames.empty())
+    {
+        frame_id = freeFrames.back();
+        freeFrames.pop_back();
+        return true;
+    }
+
+    if (!replacer->victim(frame_id))
+        return false; // every frame is pinned
+
+    Frame &frame = frames[frame_id];
+    if (frame.dirty && !writeBlock(frame.block_id, frame.block))
+    {
+        // Keep the frame resident rather than lose the modification
+        replacer->restore(frame_id, frame.block_id);
+        return false;
+    }
+
+    pageTable.erase(frame.block_id);
+    frame.dirty = false;
+    return true;
+}
+
+Block *BufferPool::fetchBlock(std::uint32_t block_id)
+{
+    std::lock_guard<std::mutex> guard(latch);
+
+    auto it = pageTable.find(block_id);
+    if (it != pageTable.end())
+    {
+        hits++;
+        Frame &frame = frames[it->second];
+        frame.pin_count++;
+        replacer->recordAccess(it->second, block_id, true);
+        replacer->setEvictable(it->second, false);
+        return &frame.block;
+    }
+
+    misses++;
+
+    std::size_t frame_id;
+    if (!acquireFrame(frame_id))
+    {
+        std::cerr << "Buffer pool exhausted: all " << frames.size() << " frames are pinned" << '\n';
+        return nullptr;
+    }
+
+    Frame &frame = frames[frame_id];
+    if (!readBlock(block_id, frame.block))
+    {
+        freeFrames.push_back(frame_id);
+        return nullptr;
+    }
+
+    frame.block_id = block_id;
+    frame.pin_count = 1;
+    frame.dirty = false;
+    pageTable[block_id] = frame_id;
+
+    replacer->recordAccess(frame_id, block_id, false);
+    replacer->setEvictable(frame_id, false);
+
+    return &frame.block;
+}
+
+bool BufferPool::unpinBlock(std::uint32_t block_id, bool is_dirty)
+{
+    std::lock_guard<std::mutex> guard(latch);
+
+    auto it = pageTable.find(block_id);
+    if (it == pageTable.end())
+        return false;
+
+    Frame &frame = frames[it->second];
+    if (frame.pin_count <= 0)
+        return false;
+
+    frame.dirty = frame.dirty || is_dirty;
+    if (--frame.pin_count == 0)
+        replacer->setEvictable(it->second, true);
+
+    return true;
+}
+
+bool BufferPool::flushBlock(std::uint32_t block_id)
+{
+    std::lock_guard<std::mutex> guard(latch);
+
+    // An evicted block was already written back on its way out
+    auto it = pageTable.find(block_id);
+    if (it == pageTable.end())
+        return true;
+
+    Frame &frame = frames[it->second];
+    if (frame.dirty)
+    {
+        if (!writeBlock(block_id, frame.block))
+            return false;
+        frame.dirty = false;
+    }
+    return true;
+}
+
+bool BufferPool::flushAll()
+{
+    std::lock_guard<std::mutex> guard(latch);
+
+    bool ok = true;
+    for (const auto &[block_id, frame_id] : pageTable)
+    {
+        Frame &frame = frames[frame_id];
+        if (!frame.dirty)
+            continue;
+
+        if (writeBlock(block_id, frame.block))
+            frame.dirty = false;
+        else
+            ok = false;
+    }
+    return ok;
+}
+
+void BufferPool::setWriteBackHook(std::function<bool()> hook)
+{
+    std::lock_guard<std::mutex> guard(latch);
+    writeBackHook = std::move(hook);
+}
+
+bool BufferPool::sync()
+{
+    std::lock_guard<std::mutex> guard(latch);
+
+    // Nothing was ever written through a file that is not open
+    if (fd < 0)
+        return true;
+
+    if (::fdatasync(fd) != 0)
+    {
+        std::cerr << "Failed to sync " << filename << '\n';
+        return false;
+    }
+    return true;
+}
+
+void BufferPool::reset()
+{
+    std::lock_guard<std::mutex> guard(latch);
+
+    pageTable.clear();
+    freeFrames.clear();
+    for (std::size_t i = frames.size(); i > 0; i--)
+    {
+        frames[i - 1].pin_count = 0;
+        frames[i - 1].dirty = false;
+        freeFrames.push_back(i - 1);
+    }
+    replacer = makeReplacer(policy, frames.size());
+
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+void BufferPool::resetStats()
+{
+    hits = 0;
+    misses = 0;
+    reads = 0;
+    writes = 0;
+}
+
+void BufferPool::printStatistics() const
+{
+    std::size_t accesses = hits + misses;
+
+    std::cout << "=== Buffer Pool Statistics ===" << std::endl;
+    std::cout << "Frames: " << frames.size() << " (" << frames.size() * BLOCK_SIZE / 1024 << " KiB)" << std::endl;
+    std::cout << "Hits: " << hits << ", Misses: " << misses << std::endl;
+    std::cout << "Hit ratio: " << (accesses > 0 ? 100.0 * hits / accesses : 0.0) << "%" << std::endl;
+    std::cout << "Block reads: " << reads << ", Block writes: " << writes << std::endl;
+}
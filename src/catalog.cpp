@@ -0,0 +1,130 @@
+#include "catalog.h"
+#include "utils.h"
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+
+constexpr std::uint32_t CATALOG_MAGIC = 0x44424354; // "DBCT"
+
+template <typename T> void put(std::ofstream &file, const T &value)
+{
+    file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T> void get(std::ifstream &file, T &value)
+{
+    file.read(reinterpret_cast<char *>(&value), sizeof(T));
+}
+
+} // namespace
+
+Catalog currentCatalog()
+{
+    Catalog catalog;
+    for (std::size_t f = 0; f < RECORD_FIELD_COUNT; f++)
+        catalog.fields[f] = RECORD_FIELDS[f];
+    return catalog;
+}
+
+bool matchesSchema(const Catalog &catalog)
+{
+    Catalog expected = currentCatalog();
+    if (catalog.format_version != expected.format_version || catalog.block_size != expected.block_size ||
+        catalog.record_size != expected.record_size ||
+        catalog.max_records_per_block != expected.max_records_per_block)
+        return false;
+
+    for (std::size_t f = 0; f < RECORD_FIELD_COUNT; f++)
+        if (catalog.fields[f].offset != expected.fields[f].offset || catalog.fields[f].size != expected.fields[f].size)
+            return false;
+    return true;
+}
+
+bool saveCatalog(const std::string &filename, const Catalog &catalog)
+{
+    std::string temp_filename = filename + ".tmp";
+    {
+        std::ofstream file(temp_filename, std::ios::binary);
+        if (!file.is_open())
+        {
+            std::cerr << "Cannot write catalog: " << temp_filename << '\n';
+            return false;
+        }
+
+        put(file, CATALOG_MAGIC);
+        put(file, catalog.format_version);
+        put(file, catalog.block_size);
+        put(file, catalog.record_size);
+        put(file, catalog.max_records_per_block);
+        put(file, static_cast<std::uint32_t>(RECORD_FIELD_COUNT));
+        for (const auto &field : catalog.fields)
+        {
+            put(file, static_cast<std::uint32_t>(field.offset));
+            put(file, static_cast<std::uint32_t>(field.size));
+        }
+        put(file, catalog.layout);
+        put(file, static_cast<std::uint8_t>(catalog.clean_shutdown));
+        put(file, catalog.total_records);
+        put(file, catalog.total_blocks);
+
+        file.close();
+        if (!file)
+        {
+            std::cerr << "Failed writing catalog: " << temp_filename << '\n';
+            return false;
+        }
+    }
+
+    if (!replaceFileDurably(temp_filename, filename))
+    {
+        std::cerr << "Cannot replace catalog: " << filename << '\n';
+        return false;
+    }
+    return true;
+}
+
+bool loadCatalog(const std::string &filename, Catalog &catalog)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    std::uint32_t magic = 0;
+    std::uint32_t field_count = 0;
+    get(file, magic);
+    get(file, catalog.format_version);
+    get(file, catalog.block_size);
+    get(file, catalog.record_size);
+    get(file, catalog.max_records_per_block);
+    get(file, field_count);
+    if (!file || magic != CATALOG_MAGIC || field_count != RECORD_FIELD_COUNT)
+    {
+        std::cerr << "Not a catalog for this schema: " << filename << '\n';
+        return false;
+    }
+
+    for (auto &field : catalog.fields)
+    {
+        std::uint32_t offset = 0;
+        std::uint32_t size = 0;
+        get(file, offset);
+        get(file, size);
+        field = FieldInfo{offset, size};
+    }
+
+    std::uint8_t clean = 0;
+    get(file, catalog.layout);
+    get(file, clean);
+    get(file, catalog.total_records);
+    get(file, catalog.total_blocks);
+    catalog.clean_shutdown = clean != 0;
+
+    if (!file)
+    {
+        std::cerr << "Truncated catalog: " << filename << '\n';
+        return false;
+    }
+    return true;
+}
@@ -1,8 +1,13 @@
+#include "async_reader.h"
 #include "block.h"
 #include "constants.h"
 #include "disk.h"
+#include "page.h"
 #include "record.h"
+#include "thread_pool.h"
+#include "tsv_parser.h"
 #include "utils.h"
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
@@ -10,77 +15,199 @@
 #include <ios>
 #include <iostream>
 #include <iterator>
-#include <sstream>
+#include <numeric>
 #include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
-Disk::Disk(const std::string &filename) : filename{filename}, ttlBlks{0}, ttlRecs{0}
+namespace
 {
+
+// Text handed to each parser thread per round of a parallel load
+constexpr std::size_t INGEST_BYTES_PER_THREAD = 1 << 20;
+
+// Permutation of refs visiting them block by block
+std::vector<std::size_t> blockOrder(const std::vector<RecordRef> &refs)
+{
+    std::vector<std::size_t> order(refs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&refs](std::size_t a, std::size_t b) { return refs[a].block_id < refs[b].block_id; });
+    return order;
 }
 
-bool Disk::loadData()
+// Splits a run of whole lines into up to parts pieces of similar size, each ending at a newline
+std::vector<std::string_view> splitAtNewlines(std::string_view text, std::size_t parts)
 {
-    std::ifstream txtFile{std::string(DATA_FILE)};
-    if (!txtFile.is_open())
+    std::vector<std::string_view> pieces;
+    std::size_t start = 0;
+
+    for (std::size_t i = 1; i < parts && start < text.size(); i++)
     {
-        std::cerr << "Cannot open file: " << DATA_FILE << '\n';
-        return false;
+        std::size_t target = std::max(start, text.size() * i / parts);
+        std::size_t newline = text.find('\n', target);
+        std::size_t end = newline == std::string_view::npos ? text.size() : newline + 1;
+
+        pieces.push_back(text.substr(start, end - start));
+        start = end;
     }
+    if (start < text.size())
+        pieces.push_back(text.substr(start));
 
-    std::string line;
+    return pieces;
+}
 
-    // Skip header
-    std::getline(txtFile, line);
+} // namespace
 
-    while (std::getline(txtFile, line))
-        records.emplace_back(parseTxtData(line));
+Disk::Disk(const std::string &filename, const DiskOptions &options)
+    : filename{filename}, ttlBlks{0}, ttlRecs{0}, options{options}, markedUnclean{false},
+      pool{std::make_unique<BufferPool>(filename, options.pool_frames, options.replacement_policy)}
+{
+    if (options.backend == StorageBackend::MMAP)
+        mapped = std::make_unique<MappedFile>(filename, true);
 
-    txtFile.close();
+    if (options.write_ahead_log)
+    {
+        wal = std::make_unique<WriteAheadLog>(filename + ".wal");
+        if (wal->open())
+            pool->setWriteBackHook([this] { return wal->commitAll(); });
+        else
+            wal.reset();
+    }
+}
 
-    ttlRecs = records.size();
-    ttlBlks = (ttlRecs + MAX_RECORDS_PER_BLOCK - 1) / MAX_RECORDS_PER_BLOCK;
+Block *Disk::pinBlock(std::uint32_t block_id) const
+{
+    if (!mapped)
+        return pool->fetchBlock(block_id);
 
-    return writeToDisk(records);
+    std::lock_guard<std::mutex> guard(mapLatch);
+    std::size_t end = (static_cast<std::size_t>(block_id) + 1) * BLOCK_SIZE;
+    if (end > mapped->size() && !mapped->map())
+        return nullptr;
+    if (end > mapped->size())
+        return nullptr;
+
+    return reinterpret_cast<Block *>(mapped->data() + static_cast<std::size_t>(block_id) * BLOCK_SIZE);
 }
 
-Record Disk::parseTxtData(const std::string &data)
+void Disk::unpinBlock(std::uint32_t block_id, bool is_dirty) const
 {
-    Record rec;
-    std::stringstream ss(data);
-    std::string token;
+    // Writes into a shared mapping are already in the page cache
+    if (!mapped)
+        pool->unpinBlock(block_id, is_dirty);
+}
 
-    std::getline(ss, token, '\t');
-    rec.game_date_est = dateToInt_2Byte(token);
+void Disk::adviseAccess(AccessPattern pattern) const
+{
+    // pinBlock may be remapping the file; the advice is kept for the next map() either way
+    std::lock_guard<std::mutex> guard(mapLatch);
+    if (mapped)
+        mapped->advise(pattern);
+}
+
+bool Disk::loadData()
+{
+    unsigned threads = options.ingest_threads;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    TsvReader reader{std::string(DATA_FILE), threads > 1 ? threads * INGEST_BYTES_PER_THREAD : 1 << 20};
+    if (!reader.isOpen())
+    {
+        std::cerr << "Cannot open file: " << DATA_FILE << '\n';
+        return false;
+    }
 
-    std::getline(ss, token, '\t');
-    rec.team_ID_home = token.empty() ? 0 : std::stoul(token);
+    // Skip header
+    std::string_view header;
+    reader.nextLine(header);
 
-    std::getline(ss, token, '\t');
-    rec.pts_home = static_cast<std::uint8_t>(token.empty() ? 0 : std::stoul(token));
+    // Rows go straight from the read buffer into blocks, only one buffer and one block are held at a time
+    if (threads <= 1)
+        return ingest([&reader](Record &rec) { return reader.next(rec); });
 
-    std::getline(ss, token, '\t');
-    rec.fg_pct_home = token.empty() ? 0.0f : std::stof(token);
+    // Each buffer of whole lines is cut into one piece per thread and parsed in parallel. The
+    // pieces are then handed to ingest in file order, so block placement and RecordRefs are
+    // exactly what the serial path produces.
+    ThreadPool workers(threads);
+    std::vector<std::vector<Record>> parsed(threads);
+    std::size_t piece = parsed.size();
+    std::size_t pos = 0;
 
-    std::getline(ss, token, '\t');
-    rec.ft_pct_home = token.empty() ? 0.0f : std::stof(token);
+    auto parseNextBuffer = [&]() {
+        std::string_view chunk;
+        if (!reader.nextChunk(chunk))
+            return false;
 
-    std::getline(ss, token, '\t');
-    rec.fg3_pct_home = token.empty() ? 0.0f : std::stof(token);
+        std::vector<std::string_view> pieces = splitAtNewlines(chunk, threads);
+        for (std::size_t i = 0; i < parsed.size(); i++)
+        {
+            parsed[i].clear();
+            if (i < pieces.size())
+                workers.submit([&parsed, &pieces, i] { parseGameRows(pieces[i], parsed[i]); });
+        }
+        workers.waitIdle();
 
-    std::getline(ss, token, '\t');
-    rec.ast_home = static_cast<std::uint8_t>(token.empty() ? 0 : std::stoul(token));
+        piece = 0;
+        pos = 0;
+        return true;
+    };
 
-    std::getline(ss, token, '\t');
-    rec.reb_home = static_cast<std::uint8_t>(token.empty() ? 0 : std::stoul(token));
+    return ingest([&](Record &rec) {
+        while (true)
+        {
+            if (piece < parsed.size() && pos < parsed[piece].size())
+            {
+                rec = parsed[piece][pos++];
+                return true;
+            }
 
-    std::getline(ss, token, '\t');
-    rec.home_team_wins = static_cast<std::uint8_t>(token.empty() ? 0 : std::stoul(token));
+            if (piece < parsed.size())
+            {
+                piece++;
+                pos = 0;
+            }
+            else if (!parseNextBuffer())
+            {
+                return false;
+            }
+        }
+    });
+}
 
-    return rec;
+Record Disk::parseTxtData(const std::string &data)
+{
+    return parseGameRow(data);
 }
 
 bool Disk::writeToDisk(const std::vector<Record> &records)
 {
+    std::size_t i{};
+    return ingest([&](Record &rec) {
+        if (i == records.size())
+            return false;
+        rec = records[i++];
+        return true;
+    });
+}
+
+bool Disk::ingest(const std::function<bool(Record &)> &next)
+{
+    // Cached frames and mappings would describe the file we are about to replace
+    pool->reset();
+    if (mapped)
+        mapped->unmap();
+
+    ttlRecs = 0;
+    ttlBlks = 0;
+    freeSpace.reset();
+    zoneMap.reset();
+
     std::ofstream dbFile(filename, std::ios::binary);
     if (!dbFile.is_open())
     {
@@ -89,35 +216,156 @@ bool Disk::writeToDisk(const std::vector<Record> &records)
     }
 
     Block block;
+    initPage(block, options.layout);
     std::size_t recordsInCurrBlock{};
+    Record rec;
 
-    for (std::size_t i{}; i < records.size(); i++)
+    while (next(rec))
     {
-        std::memcpy(block.data + recordsInCurrBlock * RECORD_SIZE, &records[i], RECORD_SIZE);
+        RecordRef ref(static_cast<std::uint32_t>(ttlBlks), static_cast<std::uint16_t>(recordsInCurrBlock));
+        writeSlot(block, recordsInCurrBlock, rec);
         recordsInCurrBlock++;
+        ttlRecs++;
+
+        for (const auto &sink : ingestSinks)
+            sink(rec, ref);
 
-        if (recordsInCurrBlock == MAX_RECORDS_PER_BLOCK || i == records.size() - 1)
+        if (recordsInCurrBlock == MAX_RECORDS_PER_BLOCK)
         {
+            zoneMap.rebuildBlock(static_cast<std::uint32_t>(ttlBlks), block);
             dbFile.write(block.data, BLOCK_SIZE);
+            freeSpace.update(static_cast<std::uint32_t>(ttlBlks), 0);
+            ttlBlks++;
 
-            std::memset(block.data, 0, BLOCK_SIZE);
+            initPage(block, options.layout);
             recordsInCurrBlock = 0;
         }
     }
 
+    // Partially filled last block
+    if (recordsInCurrBlock > 0)
+    {
+        zoneMap.rebuildBlock(static_cast<std::uint32_t>(ttlBlks), block);
+        dbFile.write(block.data, BLOCK_SIZE);
+        freeSpace.update(static_cast<std::uint32_t>(ttlBlks), pageFreeSlots(block));
+        ttlBlks++;
+    }
+
     dbFile.close();
+    if (!dbFile)
+    {
+        std::cerr << "Failed writing DB File: " << filename << '\n';
+        return false;
+    }
+
+    // The freshly written file supersedes anything logged against the old one
+    if (wal && !wal->truncate())
+        return false;
+    return zoneMap.save(filename + ".zmap") && writeCatalog(true);
+}
+
+bool Disk::writeCatalog(bool clean_shutdown)
+{
+    Catalog catalog = currentCatalog();
+    catalog.layout = options.layout;
+    catalog.clean_shutdown = clean_shutdown;
+    catalog.total_records = ttlRecs;
+    catalog.total_blocks = ttlBlks;
+
+    if (!saveCatalog(filename + ".cat", catalog))
+        return false;
+    markedUnclean = !clean_shutdown;
+    return true;
+}
+
+void Disk::markUnclean()
+{
+    if (!markedUnclean)
+        writeCatalog(false);
+}
+
+void Disk::rebuildMetadata()
+{
+    zoneMap.reset();
+    freeSpace.reset(ttlBlks);
+    ttlRecs = 0;
+
+    scanBlocks([this](std::uint32_t block_id, const Block &block) {
+        zoneMap.rebuildBlock(block_id, block);
+        freeSpace.update(block_id, pageFreeSlots(block));
+        ttlRecs += pageHeader(block)->live_count;
+    });
+}
+
+bool Disk::open()
+{
+    Catalog catalog;
+    if (!loadCatalog(filename + ".cat", catalog))
+        return false;
+
+    if (!matchesSchema(catalog))
+    {
+        std::cerr << filename << " was written with a different record or page format" << '\n';
+        return false;
+    }
+
+    struct stat st;
+    if (::stat(filename.c_str(), &st) != 0)
+    {
+        std::cerr << "Cannot open DB File: " << filename << '\n';
+        return false;
+    }
+
+    pool->reset();
+    if (mapped)
+        mapped->unmap();
+
+    options.layout = catalog.layout;
+    ttlRecs = static_cast<std::size_t>(catalog.total_records);
+    ttlBlks = static_cast<std::size_t>(catalog.total_blocks);
+
+    // Clean shutdown: the catalog and zone map describe the file exactly, free space follows from the live counts
+    if (catalog.clean_shutdown && static_cast<std::size_t>(st.st_size) == ttlBlks * BLOCK_SIZE &&
+        zoneMap.load(filename + ".zmap") && zoneMap.getNumBlocks() == ttlBlks)
+    {
+        freeSpace.reset(ttlBlks);
+        for (std::uint32_t block_id = 0; block_id < ttlBlks; block_id++)
+            freeSpace.update(block_id, MAX_RECORDS_PER_BLOCK - zoneMap.getZone(block_id)->live_count);
+        markedUnclean = false;
+        return true;
+    }
+
+    // Otherwise trust only the pages themselves
+    ttlBlks = static_cast<std::size_t>(st.st_size) / BLOCK_SIZE;
+    rebuildMetadata();
+    markedUnclean = true;
     return true;
 }
 
+void Disk::addIngestSink(RecordSink sink)
+{
+    ingestSinks.push_back(std::move(sink));
+}
+
+void Disk::registerIndex(BPlusTree *index, RecordField key_field)
+{
+    indexes.push_back({index, key_field});
+}
+
+void Disk::unregisterIndex(BPlusTree *index)
+{
+    indexes.erase(std::remove_if(indexes.begin(), indexes.end(),
+                                 [index](const RegisteredIndex &entry) { return entry.tree == index; }),
+                  indexes.end());
+}
+
 void Disk::printStats() const
 {
     std::cout << "Size of Record: " << sizeof(Record) << " bytes" << std::endl;
     std::cout << "Total No. of Records: " << ttlRecs << '\n';
     std::cout << "Total No. of Blocks: " << ttlBlks << '\n';
     std::cout << "Max Records per Block: " << MAX_RECORDS_PER_BLOCK << '\n';
-    std::cout << "No. of Records in Last Block: "
-              << (ttlRecs % MAX_RECORDS_PER_BLOCK == 0 ? MAX_RECORDS_PER_BLOCK : ttlRecs % MAX_RECORDS_PER_BLOCK)
-              << '\n';
+    std::cout << "No. of Records in Last Block: " << (ttlBlks > 0 ? recordsInBlock(ttlBlks - 1) : 0) << '\n';
     std::cout << std::endl;
 }
 
@@ -131,94 +379,662 @@ int Disk::getTtlRecs() const
     return (int)ttlRecs;
 }
 
-std::vector<std::pair<float, RecordRef>> Disk::getAllFTPctHomeValues() const
+std::size_t Disk::recordsInBlock(std::uint32_t block_id) const
 {
-    std::vector<std::pair<float, RecordRef>> ft_pct_values;
-    ft_pct_values.reserve(records.size());
+    Block *block = pinBlock(block_id);
+    if (!block)
+        return 0;
+
+    std::size_t live = pageHeader(*block)->live_count;
+    unpinBlock(block_id, false);
+    return live;
+}
+
+bool Disk::isRecordLive(const RecordRef &ref) const
+{
+    Block *block = pinBlock(ref.block_id);
+    if (!block)
+        return false;
+
+    bool live = isSlotLive(*block, ref.record_offset);
+    unpinBlock(ref.block_id, false);
+    return live;
+}
 
-    for (std::size_t i = 0; i < records.size(); i++)
+std::size_t Disk::scanBlocks(const std::function<void(std::uint32_t block_id, const Block &block)> &visit,
+                             const ScanPredicate *prune) const
+{
+    adviseAccess(AccessPattern::SEQUENTIAL);
+    return scanBlockRange(0, static_cast<std::uint32_t>(ttlBlks), visit, prune);
+}
+
+std::size_t Disk::scanBlockRange(std::uint32_t begin, std::uint32_t end,
+                                 const std::function<void(std::uint32_t block_id, const Block &block)> &visit,
+                                 const ScanPredicate *prune) const
+{
+    std::size_t visited = 0;
+    end = std::min(end, static_cast<std::uint32_t>(ttlBlks));
+    for (std::uint32_t block_id = begin; block_id < end; block_id++)
     {
-        // Calculate block and record position
-        std::uint32_t block_id = static_cast<std::uint32_t>(i / MAX_RECORDS_PER_BLOCK);
-        std::uint16_t record_offset = static_cast<std::uint16_t>(i % MAX_RECORDS_PER_BLOCK);
+        if (prune && !zoneMap.mayMatch(block_id, *prune))
+            continue;
 
-        RecordRef ref(block_id, record_offset);
-        ft_pct_values.emplace_back(records[i].ft_pct_home, ref);
+        Block *block = pinBlock(block_id);
+        if (!block)
+        {
+            std::cerr << "Cannot read block " << block_id << " from " << filename << '\n';
+            continue;
+        }
+
+        visit(block_id, *block);
+        unpinBlock(block_id, false);
+        visited++;
     }
+    return visited;
+}
+
+void Disk::scanRecords(const RecordSink &visit) const
+{
+    scanBlocks([&visit](std::uint32_t block_id, const Block &block) {
+        forEachLiveSlot(block, [&](std::size_t slot) {
+            visit(readSlot(block, slot), RecordRef(block_id, static_cast<std::uint16_t>(slot)));
+        });
+    });
+}
+
+ColumnSummary Disk::summarizeColumn(RecordField field) const
+{
+    ColumnSummary summary;
+
+    scanBlocks([&summary, field](std::uint32_t, const Block &block) {
+        forEachLiveSlot(block, [&](std::size_t slot) {
+            double value = readFieldAsDouble(block, field, slot);
+            if (summary.count == 0 || value < summary.min)
+                summary.min = value;
+            if (summary.count == 0 || value > summary.max)
+                summary.max = value;
+            summary.sum += value;
+            summary.count++;
+        });
+    });
+
+    return summary;
+}
+
+void Disk::scanIndexKeys(RecordField field, const std::function<void(float key, const RecordRef &ref)> &visit) const
+{
+    scanBlocks([&](std::uint32_t block_id, const Block &block) {
+        forEachLiveSlot(block, [&](std::size_t slot) {
+            visit(static_cast<float>(readFieldAsDouble(block, field, slot)),
+                  RecordRef(block_id, static_cast<std::uint16_t>(slot)));
+        });
+    });
+}
+
+std::vector<std::pair<float, RecordRef>> Disk::getAllFTPctHomeValues() const
+{
+    std::vector<std::pair<float, RecordRef>> ft_pct_values;
+    ft_pct_values.reserve(ttlRecs);
+
+    scanIndexKeys(RecordField::FT_PCT_HOME,
+                  [&ft_pct_values](float key, const RecordRef &ref) { ft_pct_values.emplace_back(key, ref); });
 
     return ft_pct_values;
 }
 
 Record Disk::getRecord(const RecordRef &ref) const
 {
-    // Always read from disk file to simulate actual disk I/O
-    std::ifstream dbFile(filename, std::ios::binary);
-    if (!dbFile.is_open())
+    Block *block = pinBlock(ref.block_id);
+    if (!block)
     {
-        std::cerr << "Cannot open database file: " << filename << '\n';
+        std::cerr << "Cannot read block " << ref.block_id << " from " << filename << '\n';
         return Record{}; // Return empty record on error
     }
 
-    // Calculate file position
-    std::size_t block_offset = ref.block_id * BLOCK_SIZE;
-    std::size_t record_position = block_offset + (ref.record_offset * RECORD_SIZE);
-
-    // Seek to record position and read
-    dbFile.seekg(record_position);
-    Record record;
-    dbFile.read(reinterpret_cast<char *>(&record), RECORD_SIZE);
-    dbFile.close();
+    // Deleted slots read back as an empty record
+    Record record = isSlotLive(*block, ref.record_offset) ? readSlot(*block, ref.record_offset) : Record{};
+    unpinBlock(ref.block_id, false);
 
     return record;
 }
 
 std::vector<Record> Disk::getRecords(const std::vector<RecordRef> &refs) const
 {
-    std::vector<Record> result;
-    result.reserve(refs.size());
+    auto [result, blocks_read] = getRecordsWithStats(refs);
+    return result;
+}
 
-    for (const auto &ref : refs)
+std::pair<std::vector<Record>, int> Disk::getRecordsWithStats(const std::vector<RecordRef> &refs) const
+{
+    std::vector<Record> result(refs.size());
+    int blocks_read = 0;
+
+    if (options.async_queue_depth > 0)
+    {
+        blocks_read = getRecordsAsync(
+            refs, [&result](std::size_t index, const Record &record) { result[index] = record; },
+            options.async_queue_depth);
+        return {result, blocks_read};
+    }
+
+    adviseAccess(AccessPattern::RANDOM);
+
+    // Visit refs in block order without disturbing the caller's order
+    std::vector<std::size_t> order = blockOrder(refs);
+
+    std::size_t i = 0;
+    while (i < order.size())
+    {
+        std::uint32_t block_id = refs[order[i]].block_id;
+
+        std::size_t group_end = i;
+        while (group_end < order.size() && refs[order[group_end]].block_id == block_id)
+            group_end++;
+
+        Block *block = pinBlock(block_id);
+        if (!block)
+        {
+            std::cerr << "Cannot read block " << block_id << " from " << filename << '\n';
+        }
+        else
+        {
+            blocks_read++;
+            for (std::size_t j = i; j < group_end; j++)
+            {
+                std::size_t pos = order[j];
+                if (isSlotLive(*block, refs[pos].record_offset))
+                    result[pos] = readSlot(*block, refs[pos].record_offset);
+            }
+            unpinBlock(block_id, false);
+        }
+
+        i = group_end;
+    }
+
+    return {result, blocks_read};
+}
+
+int Disk::getRecordsAsync(const std::vector<RecordRef> &refs,
+                          const std::function<void(std::size_t index, const Record &)> &on_record,
+                          unsigned queue_depth) const
+{
+    // The reader goes around the pool, so the file has to be current first
+    bool synced = mapped ? mapped->sync() : pool->flushAll();
+    if (!synced)
+        return 0;
+
+    std::vector<std::size_t> order = blockOrder(refs);
+
+    // Distinct blocks in file order, each with its slice of order
+    std::vector<std::uint32_t> block_ids;
+    std::unordered_map<std::uint32_t, std::pair<std::size_t, std::size_t>> slices;
+    for (std::size_t i = 0; i < order.size(); i++)
     {
-        result.push_back(getRecord(ref));
+        std::uint32_t block_id = refs[order[i]].block_id;
+        if (block_ids.empty() || block_ids.back() != block_id)
+        {
+            block_ids.push_back(block_id);
+            slices[block_id] = {i, i};
+        }
+        slices[block_id].second = i + 1;
     }
 
+    AsyncBlockReader reader(filename, queue_depth);
+    std::size_t blocks_read = reader.readBlocks(block_ids, [&](std::uint32_t block_id, const Block &block) {
+        auto [begin, end] = slices[block_id];
+        for (std::size_t j = begin; j < end; j++)
+        {
+            std::size_t pos = order[j];
+            std::uint16_t slot = refs[pos].record_offset;
+            on_record(pos, isSlotLive(block, slot) ? readSlot(block, slot) : Record{});
+        }
+    });
+
+    return static_cast<int>(blocks_read);
+}
+
+const Record *Disk::viewRecord(const RecordRef &ref) const
+{
+    if (!mapped)
+        return nullptr;
+
+    // Mapped blocks are never evicted, so there is nothing to hold pinned
+    Block *block = pinBlock(ref.block_id);
+    if (!block || pageLayout(*block) != PageLayout::ROW || !isSlotLive(*block, ref.record_offset))
+        return nullptr;
+
+    return reinterpret_cast<const Record *>(slotData(*block, ref.record_offset));
+}
+
+std::vector<const Record *> Disk::viewRecords(const std::vector<RecordRef> &refs) const
+{
+    std::vector<const Record *> result;
+    result.reserve(refs.size());
+
+    adviseAccess(AccessPattern::RANDOM);
+    for (const auto &ref : refs)
+        result.push_back(viewRecord(ref));
+
     return result;
 }
 
-bool Disk::deleteRecord(const RecordRef &ref)
+bool Disk::appendBlocks(const std::vector<Block> &blocks)
 {
-    // Open database file for writing
-    std::fstream dbFile(filename, std::ios::in | std::ios::out | std::ios::binary);
+    std::ofstream dbFile(filename, std::ios::binary | std::ios::app);
     if (!dbFile.is_open())
     {
-        std::cerr << "Cannot open database file for deletion: " << filename << '\n';
+        std::cerr << "Cannot open DB File for appending: " << filename << '\n';
         return false;
     }
 
-    // Calculate file position
-    std::size_t block_offset = ref.block_id * BLOCK_SIZE;
-    std::size_t record_position = block_offset + (ref.record_offset * RECORD_SIZE);
+    for (const auto &block : blocks)
+        dbFile.write(block.data, BLOCK_SIZE);
 
-    // Write zeros to mark as deleted
-    Record empty_record{};
-    dbFile.seekp(record_position);
-    dbFile.write(reinterpret_cast<const char *>(&empty_record), RECORD_SIZE);
     dbFile.close();
+    if (!dbFile)
+    {
+        // A partial block left at the end would shift every block appended after it
+        std::cerr << "Failed appending to DB File: " << filename << '\n';
+        if (::truncate(filename.c_str(), static_cast<off_t>(ttlBlks * BLOCK_SIZE)) != 0)
+            std::cerr << "Cannot cut off the failed append: " << filename << '\n';
+        return false;
+    }
 
+    ttlBlks += blocks.size();
     return true;
 }
 
+void Disk::logInsert(const RecordRef &ref, const Record &rec)
+{
+    if (!wal)
+        return;
+
+    LogRecord entry;
+    entry.type = LogType::DATA_INSERT;
+    entry.ref = ref;
+    entry.record = rec;
+    wal->append(entry);
+}
+
+bool Disk::insertRecord(const Record &rec, RecordRef &ref)
+{
+    std::vector<RecordRef> refs = insertRecords({rec});
+    if (refs.empty())
+        return false;
+
+    ref = refs.front();
+    return true;
+}
+
+std::vector<RecordRef> Disk::insertRecords(const std::vector<Record> &records)
+{
+    std::vector<RecordRef> refs;
+    if (records.empty())
+        return refs;
+
+    markUnclean();
+    refs.reserve(records.size());
+
+    // Holes left by deletes first, lowest block first
+    std::uint32_t block_id;
+    while (refs.size() < records.size() && freeSpace.findBlockWithSpace(block_id))
+    {
+        Block *block = pinBlock(block_id);
+        if (!block)
+        {
+            std::cerr << "Cannot read block " << block_id << " for insertion into " << filename << '\n';
+            break;
+        }
+
+        std::size_t placed = 0;
+        int slot;
+        while (refs.size() < records.size() && (slot = findFreeSlot(*block)) >= 0)
+        {
+            RecordRef ref(block_id, static_cast<std::uint16_t>(slot));
+            const Record &rec = records[refs.size()];
+
+            logInsert(ref, rec);
+            writeSlot(*block, static_cast<std::size_t>(slot), rec);
+            refs.push_back(ref);
+            placed++;
+        }
+
+        if (placed == 0)
+        {
+            // The page header claims room the slot bitmap does not have; listing it again would loop forever
+            std::cerr << "Block " << block_id << " of " << filename << " reports free space but has no free slot\n";
+            freeSpace.update(block_id, 0);
+        }
+        else
+        {
+            freeSpace.update(block_id, pageFreeSlots(*block));
+            zoneMap.rebuildBlock(block_id, *block);
+        }
+        unpinBlock(block_id, placed > 0);
+    }
+
+    // Whatever is left is packed into new blocks and appended in one go
+    std::size_t in_place = refs.size();
+    if (in_place < records.size())
+    {
+        std::size_t remaining = records.size() - in_place;
+        std::vector<Block> blocks((remaining + MAX_RECORDS_PER_BLOCK - 1) / MAX_RECORDS_PER_BLOCK);
+        std::vector<RecordRef> appended;
+        appended.reserve(remaining);
+
+        for (std::size_t i = 0; i < remaining; i++)
+        {
+            Block &block = blocks[i / MAX_RECORDS_PER_BLOCK];
+            std::size_t slot = i % MAX_RECORDS_PER_BLOCK;
+            if (slot == 0)
+                initPage(block, options.layout);
+
+            RecordRef ref(static_cast<std::uint32_t>(ttlBlks + i / MAX_RECORDS_PER_BLOCK),
+                          static_cast<std::uint16_t>(slot));
+            logInsert(ref, records[in_place + i]);
+            writeSlot(block, slot, records[in_place + i]);
+            appended.push_back(ref);
+        }
+
+        // The new blocks skip the pool and its write-back hook, so their log records go out first
+        std::uint32_t first_block = static_cast<std::uint32_t>(ttlBlks);
+        bool logged = !wal || wal->commitAll();
+        if (logged && appendBlocks(blocks))
+        {
+            for (std::size_t b = 0; b < blocks.size(); b++)
+            {
+                zoneMap.rebuildBlock(first_block + static_cast<std::uint32_t>(b), blocks[b]);
+                freeSpace.update(first_block + static_cast<std::uint32_t>(b), pageFreeSlots(blocks[b]));
+            }
+            refs.insert(refs.end(), appended.begin(), appended.end());
+        }
+        else if (logged && wal)
+        {
+            // The inserts are durable in the log but reported as not stored: log their undoing too,
+            // so recover() does not bring them back
+            for (const auto &ref : appended)
+            {
+                LogRecord entry;
+                entry.type = LogType::DATA_DELETE;
+                entry.ref = ref;
+                wal->append(entry);
+            }
+            if (!wal->commitAll())
+                std::cerr << "Cannot log the undoing of failed inserts into " << filename << '\n';
+        }
+    }
+
+    if (refs.size() < records.size())
+        std::cerr << "Stored " << refs.size() << " of " << records.size() << " records in " << filename << '\n';
+    ttlRecs += refs.size();
+
+    // Indexes take the new entries sorted by key, so consecutive inserts land in the same leaves
+    for (const auto &index : indexes)
+    {
+        std::vector<std::pair<float, RecordRef>> entries;
+        entries.reserve(refs.size());
+        for (std::size_t i = 0; i < refs.size(); i++)
+            entries.emplace_back(static_cast<float>(recordFieldAsDouble(records[i], index.key_field)), refs[i]);
+        std::sort(entries.begin(), entries.end());
+
+        for (const auto &[key, ref] : entries)
+            index.tree->insert(key, ref);
+    }
+
+    return refs;
+}
+
+bool Disk::deleteRecord(const RecordRef &ref)
+{
+    markUnclean();
+
+    Block *block = pinBlock(ref.block_id);
+    if (!block)
+    {
+        std::cerr << "Cannot read block " << ref.block_id << " for deletion from " << filename << '\n';
+        return false;
+    }
+
+    if (wal && isSlotLive(*block, ref.record_offset))
+    {
+        LogRecord entry;
+        entry.type = LogType::DATA_DELETE;
+        entry.ref = ref;
+        wal->append(entry);
+    }
+
+    // Tombstone the slot, the pool writes the block back on eviction or flush
+    bool erased = eraseSlot(*block, ref.record_offset);
+    if (erased)
+    {
+        ttlRecs--;
+        freeSpace.update(ref.block_id, pageFreeSlots(*block));
+        zoneMap.removeSlot(ref.block_id, *block, ref.record_offset);
+    }
+    unpinBlock(ref.block_id, erased);
+
+    return erased;
+}
+
 int Disk::deleteRecords(const std::vector<RecordRef> &refs)
 {
+    auto [deleted_count, blocks_touched] = deleteRecordsWithStats(refs);
+    return deleted_count;
+}
+
+std::pair<int, int> Disk::deleteRecordsWithStats(const std::vector<RecordRef> &refs, bool sync)
+{
+    markUnclean();
+
     int deleted_count = 0;
+    int blocks_touched = 0;
+    bool ok = true;
 
-    for (const auto &ref : refs)
+    std::vector<std::size_t> order = blockOrder(refs);
+    std::vector<std::uint32_t> touched;
+
+    std::size_t i = 0;
+    while (i < order.size())
     {
-        if (deleteRecord(ref))
+        std::uint32_t block_id = refs[order[i]].block_id;
+
+        std::size_t group_end = i;
+        while (group_end < order.size() && refs[order[group_end]].block_id == block_id)
+            group_end++;
+
+        Block *block = pinBlock(block_id);
+        if (!block)
+        {
+            std::cerr << "Cannot read block " << block_id << " for deletion from " << filename << '\n';
+            ok = false;
+            i = group_end;
+            continue;
+        }
+
+        // Only slots found live are logged, as in deleteRecord
+        int erased = 0;
+        for (std::size_t j = i; j < group_end; j++)
+        {
+            const RecordRef &ref = refs[order[j]];
+            if (!isSlotLive(*block, ref.record_offset))
+                continue;
+
+            if (wal)
+            {
+                LogRecord entry;
+                entry.type = LogType::DATA_DELETE;
+                entry.ref = ref;
+                wal->append(entry);
+            }
+            eraseSlot(*block, ref.record_offset);
+            erased++;
+        }
+
+        // Space and zone bookkeeping once per block instead of once per record
+        if (erased > 0)
         {
-            deleted_count++;
+            ttlRecs -= static_cast<std::size_t>(erased);
+            freeSpace.update(block_id, pageFreeSlots(*block));
+            zoneMap.rebuildBlock(block_id, *block);
         }
+        unpinBlock(block_id, erased > 0);
+
+        if (erased > 0)
+        {
+            touched.push_back(block_id);
+            deleted_count += erased;
+            blocks_touched++;
+        }
+
+        i = group_end;
     }
 
-    return deleted_count;
+    // Written back once the whole batch is logged: the first block then forces it out in one commit.
+    // Writes into the mapping are already in the page cache
+    if (!mapped)
+        for (std::uint32_t block_id : touched)
+            if (!pool->flushBlock(block_id))
+                ok = false;
+
+    // With a log, the commit is the durability point and data.db catches up at the next checkpoint
+    if (sync && wal && !wal->commitAll())
+        ok = false;
+    else if (sync && !wal && blocks_touched > 0 && !(mapped ? mapped->sync() : pool->sync()))
+        ok = false;
+    if (!ok)
+        std::cerr << "Batched delete did not reach disk completely: " << filename << '\n';
+
+    return {deleted_count, blocks_touched};
+}
+
+bool Disk::flush()
+{
+    bool flushed = mapped ? mapped->sync() : pool->flushAll();
+    return zoneMap.save(filename + ".zmap") && flushed;
+}
+
+bool Disk::commitLog()
+{
+    return !wal || wal->commitAll();
+}
+
+bool Disk::checkpoint(BPlusTree *index)
+{
+    // flush writes the log out first through the pool's write-back hook
+    bool ok = flush();
+    if (!mapped)
+        ok = pool->sync() && ok;
+    if (index)
+        ok = index->saveToDisk() && ok;
+
+    // Only an entirely persisted state may forget its log
+    if (!ok)
+    {
+        std::cerr << "Checkpoint failed, keeping the write-ahead log: " << filename << '\n';
+        return false;
+    }
+    if (wal && !wal->truncate())
+        return false;
+    return writeCatalog(true);
+}
+
+std::size_t Disk::recover(BPlusTree *index)
+{
+    if (!wal)
+        return 0;
+
+    std::vector<LogRecord> records;
+    if (!wal->readAll(records) || records.empty())
+        return 0;
+
+    markUnclean();
+
+    // Replaying must not log the same operations again
+    if (index)
+        index->attachLog(nullptr);
+
+    for (const auto &entry : records)
+    {
+        switch (entry.type)
+        {
+        case LogType::DATA_DELETE:
+        case LogType::DATA_INSERT: {
+            // An insert may have gone to a block that never reached data.db
+            if (entry.type == LogType::DATA_INSERT && entry.ref.block_id >= ttlBlks)
+            {
+                std::uint32_t first_block = static_cast<std::uint32_t>(ttlBlks);
+                std::vector<Block> blocks(entry.ref.block_id + 1 - ttlBlks);
+                for (auto &block : blocks)
+                    initPage(block, options.layout);
+
+                if (appendBlocks(blocks))
+                {
+                    for (std::size_t b = 0; b < blocks.size(); b++)
+                    {
+                        zoneMap.rebuildBlock(first_block + static_cast<std::uint32_t>(b), blocks[b]);
+                        freeSpace.update(first_block + static_cast<std::uint32_t>(b), MAX_RECORDS_PER_BLOCK);
+                    }
+                }
+            }
+
+            Block *block = pinBlock(entry.ref.block_id);
+            if (!block)
+            {
+                std::cerr << "Cannot redo log record " << entry.lsn << ", block " << entry.ref.block_id
+                          << " is unreadable" << '\n';
+                continue;
+            }
+
+            bool changed;
+            if (entry.type == LogType::DATA_DELETE)
+            {
+                changed = eraseSlot(*block, entry.ref.record_offset);
+                if (changed)
+                    ttlRecs--;
+            }
+            else
+            {
+                // A torn append can leave an all-zero block behind
+                PageHeader *header = pageHeader(*block);
+                if (header->slot_count == 0 && header->live_count == 0)
+                    initPage(*block, options.layout);
+
+                bool was_live = isSlotLive(*block, entry.ref.record_offset);
+                writeSlot(*block, entry.ref.record_offset, entry.record);
+                changed = true;
+                if (!was_live)
+                    ttlRecs++;
+            }
+
+            if (changed)
+            {
+                freeSpace.update(entry.ref.block_id, pageFreeSlots(*block));
+                zoneMap.rebuildBlock(entry.ref.block_id, *block);
+            }
+            unpinBlock(entry.ref.block_id, changed);
+            break;
+        }
+        case LogType::INDEX_INSERT:
+            if (index)
+            {
+                std::vector<RecordRef> existing = index->search(entry.key);
+                if (std::find(existing.begin(), existing.end(), entry.ref) == existing.end())
+                    index->insert(entry.key, entry.ref);
+            }
+            break;
+        case LogType::INDEX_DELETE:
+            if (index)
+                index->deleteKey(entry.key, entry.ref);
+            break;
+        case LogType::INDEX_DELETE_GREATER:
+            if (index)
+                index->deleteGreaterThan(entry.key);
+            break;
+        }
+    }
+
+    if (index)
+        index->attachLog(wal.get());
+
+    return records.size();
 }
@@ -0,0 +1,288 @@
+#include "external_sort.h"
+#include "index_sort.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+
+// Smallest read buffer a run gets during the merge, whatever the budget
+constexpr std::size_t MIN_RUN_BUFFER = 4096;
+
+void encodeEntry(const IndexEntry &entry, char *out)
+{
+    std::memcpy(out, &entry.first, sizeof(float));
+    std::memcpy(out + sizeof(float), &entry.second.block_id, sizeof(std::uint32_t));
+    std::memcpy(out + sizeof(float) + sizeof(std::uint32_t), &entry.second.record_offset, sizeof(std::uint16_t));
+}
+
+void decodeEntry(const char *in, IndexEntry &entry)
+{
+    std::memcpy(&entry.first, in, sizeof(float));
+    std::memcpy(&entry.second.block_id, in + sizeof(float), sizeof(std::uint32_t));
+    std::memcpy(&entry.second.record_offset, in + sizeof(float) + sizeof(std::uint32_t), sizeof(std::uint16_t));
+}
+
+} // namespace
+
+bool ExternalSorter::RunReader::advance()
+{
+    if (end - begin < RUN_ENTRY_SIZE)
+    {
+        // Keep a partial entry at the front and top the buffer up behind it
+        std::size_t left = end - begin;
+        std::memmove(buffer.data(), buffer.data() + begin, left);
+        begin = 0;
+        end = left + std::fread(buffer.data() + left, 1, buffer.size() - left, file);
+
+        if (end < RUN_ENTRY_SIZE)
+        {
+            exhausted = true;
+            return end == 0 && !std::ferror(file);
+        }
+    }
+
+    decodeEntry(buffer.data() + begin, current);
+    begin += RUN_ENTRY_SIZE;
+    return true;
+}
+
+ExternalSorter::ExternalSorter(const std::string &run_prefix, std::size_t memory_budget, WorkStealingPool *workers)
+    : runPrefix{run_prefix}, memoryBudget{memory_budget},
+      runCapacity{std::max<std::size_t>(1, memory_budget / (2 * sizeof(IndexEntry)))}, workers{workers},
+      nextRunId{0}, spilledRuns{0}, mergePasses{0}, inMemoryPos{0}, entryCount{0}, finished{false}, failed{false}
+{
+}
+
+ExternalSorter::~ExternalSorter()
+{
+    closeRuns();
+    for (const auto &run : runFiles)
+        std::remove(run.c_str());
+}
+
+bool ExternalSorter::add(const IndexEntry &entry)
+{
+    if (finished)
+        return false;
+
+    pending.push_back(entry);
+    entryCount++;
+    if (pending.size() >= runCapacity)
+        return spill();
+    return true;
+}
+
+bool ExternalSorter::spill()
+{
+    sortIndexEntries(pending, workers);
+
+    std::size_t pos = 0;
+    bool ok = writeRun(runPrefix + "." + std::to_string(nextRunId++), [this, &pos](IndexEntry &entry) {
+        if (pos == pending.size())
+            return false;
+        entry = pending[pos++];
+        return true;
+    });
+
+    spilledRuns++;
+    pending.clear();
+    return ok;
+}
+
+bool ExternalSorter::writeRun(const std::string &run, const std::function<bool(IndexEntry &)> &next)
+{
+    runFiles.push_back(run);
+
+    std::FILE *file = std::fopen(run.c_str(), "wb");
+    if (!file)
+    {
+        std::cerr << "Cannot create sort run: " << run << '\n';
+        failed = true;
+        return false;
+    }
+
+    // Encoded a buffer at a time instead of one fwrite per entry
+    std::vector<char> out(std::max(MIN_RUN_BUFFER, std::min(memoryBudget / 2, std::size_t{1} << 20)) /
+                          RUN_ENTRY_SIZE * RUN_ENTRY_SIZE);
+    std::size_t used = 0;
+    bool ok = true;
+    IndexEntry entry;
+    while (ok && next(entry))
+    {
+        encodeEntry(entry, out.data() + used);
+        used += RUN_ENTRY_SIZE;
+        if (used == out.size())
+        {
+            ok = std::fwrite(out.data(), 1, used, file) == used;
+            used = 0;
+        }
+    }
+    ok = ok && !failed && std::fwrite(out.data(), 1, used, file) == used;
+    ok = std::fclose(file) == 0 && ok;
+
+    if (!ok)
+    {
+        std::cerr << "Failed writing sort run: " << run << '\n';
+        failed = true;
+    }
+    return ok;
+}
+
+bool ExternalSorter::finish()
+{
+    if (finished)
+        return !failed;
+    finished = true;
+
+    // Everything fit: no run files, the entries are streamed straight from memory
+    if (runFiles.empty())
+    {
+        sortIndexEntries(pending, workers);
+        return !failed;
+    }
+
+    if (!pending.empty() && !spill())
+        return false;
+    std::vector<IndexEntry>().swap(pending);
+
+    // Every open run needs a read buffer out of the budget, which bounds how many merge at once
+    std::size_t fan_in = std::clamp<std::size_t>(memoryBudget / MIN_RUN_BUFFER, 2, MAX_MERGE_FAN_IN);
+
+    // Too many runs: merge the oldest ones into longer runs until one final merge will do
+    while (runFiles.size() > fan_in)
+    {
+        std::vector<std::string> group(runFiles.begin(), runFiles.begin() + fan_in);
+        runFiles.erase(runFiles.begin(), runFiles.begin() + fan_in);
+
+        if (!openRuns(group))
+            return false;
+        bool ok = writeRun(runPrefix + "." + std::to_string(nextRunId++),
+                           [this](IndexEntry &entry) { return popSmallest(entry); });
+        closeRuns();
+        if (!ok)
+            return false;
+        mergePasses++;
+    }
+
+    std::vector<std::string> last;
+    last.swap(runFiles);
+    mergePasses++;
+    return openRuns(last);
+}
+
+bool ExternalSorter::openRuns(std::vector<std::string> runs)
+{
+    readerFiles = std::move(runs);
+
+    // The budget is shared out as read buffers, one per run
+    std::size_t buffer_size = memoryBudget / readerFiles.size();
+    buffer_size = std::max(MIN_RUN_BUFFER, buffer_size - buffer_size % RUN_ENTRY_SIZE);
+
+    readers.resize(readerFiles.size());
+    for (std::size_t r = 0; r < readerFiles.size(); r++)
+    {
+        RunReader &reader = readers[r];
+        reader.file = std::fopen(readerFiles[r].c_str(), "rb");
+        if (!reader.file)
+        {
+            std::cerr << "Cannot reopen sort run: " << readerFiles[r] << '\n';
+            failed = true;
+            return false;
+        }
+        reader.buffer.resize(buffer_size);
+        if (!reader.advance())
+        {
+            std::cerr << "Failed reading sort run: " << readerFiles[r] << '\n';
+            failed = true;
+            return false;
+        }
+    }
+
+    losers.assign(readers.size(), 0);
+    losers[0] = readers.size() == 1 ? 0 : initLoserTree(1);
+    return true;
+}
+
+void ExternalSorter::closeRuns()
+{
+    for (auto &reader : readers)
+        if (reader.file)
+            std::fclose(reader.file);
+    for (const auto &run : readerFiles)
+        std::remove(run.c_str());
+
+    readers.clear();
+    readerFiles.clear();
+}
+
+bool ExternalSorter::beats(std::size_t a, std::size_t b) const
+{
+    if (readers[a].exhausted || readers[b].exhausted)
+        return !readers[a].exhausted;
+    if (readers[a].current < readers[b].current)
+        return true;
+    if (readers[b].current < readers[a].current)
+        return false;
+    return a < b;
+}
+
+std::size_t ExternalSorter::initLoserTree(std::size_t node)
+{
+    // Nodes k..2k-1 stand for the runs themselves
+    std::size_t k = readers.size();
+    if (node >= k)
+        return node - k;
+
+    std::size_t left = initLoserTree(2 * node);
+    std::size_t right = initLoserTree(2 * node + 1);
+    if (beats(left, right))
+    {
+        losers[node] = right;
+        return left;
+    }
+    losers[node] = left;
+    return right;
+}
+
+bool ExternalSorter::popSmallest(IndexEntry &entry)
+{
+    if (failed || readers.empty())
+        return false;
+
+    std::size_t winner = losers[0];
+    if (readers[winner].exhausted)
+        return false;
+
+    entry = readers[winner].current;
+    if (!readers[winner].advance())
+    {
+        std::cerr << "Failed reading sort run: " << readerFiles[winner] << '\n';
+        failed = true;
+        return false;
+    }
+
+    // Replay the winner's path to the root: it only meets the losers it has to beat again
+    for (std::size_t node = (winner + readers.size()) / 2; node >= 1; node /= 2)
+        if (beats(losers[node], winner))
+            std::swap(losers[node], winner);
+    losers[0] = winner;
+    return true;
+}
+
+bool ExternalSorter::next(IndexEntry &entry)
+{
+    if (!finished || failed)
+        return false;
+
+    if (spilledRuns == 0)
+    {
+        if (inMemoryPos == pending.size())
+            return false;
+        entry = pending[inMemoryPos++];
+        return true;
+    }
+    return popSmallest(entry);
+}
@@ -0,0 +1,33 @@
+#include "free_space_map.h"
+
+void FreeSpaceMap::reset(std::size_t num_blocks)
+{
+    freeSlots.assign(num_blocks, 0);
+    blocksWithSpace.clear();
+}
+
+void FreeSpaceMap::update(std::uint32_t block_id, std::size_t free_slots)
+{
+    if (block_id >= freeSlots.size())
+        freeSlots.resize(static_cast<std::size_t>(block_id) + 1, 0);
+
+    freeSlots[block_id] = static_cast<std::uint16_t>(free_slots);
+    if (free_slots > 0)
+        blocksWithSpace.insert(block_id);
+    else
+        blocksWithSpace.erase(block_id);
+}
+
+bool FreeSpaceMap::findBlockWithSpace(std::uint32_t &block_id) const
+{
+    if (blocksWithSpace.empty())
+        return false;
+
+    block_id = *blocksWithSpace.begin();
+    return true;
+}
+
+std::size_t FreeSpaceMap::getFreeSlots(std::uint32_t block_id) const
+{
+    return block_id < freeSlots.size() ? freeSlots[block_id] : 0;
+}
@@ -0,0 +1,282 @@
+#include "index_snapshot.h"
+#include "key_search.h"
+#include "utils.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+namespace
+{
+
+// First page of a snapshot file; each section after it starts on a page boundary
+struct SnapshotHeader
+{
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t block_size;
+    std::uint32_t node_keys;
+    std::uint64_t entry_count;
+    std::uint64_t levels;
+    std::uint64_t level_offset[MAX_SNAPSHOT_LEVELS];
+    std::uint64_t level_nodes[MAX_SNAPSHOT_LEVELS];
+    std::uint64_t keys_offset;
+    std::uint64_t rids_offset;
+};
+
+constexpr std::uint32_t SNAPSHOT_MAGIC = 0x42505353; // "BPSS"
+constexpr std::uint32_t SNAPSHOT_VERSION = 1;
+constexpr std::size_t NODE_BYTES = SNAPSHOT_NODE_KEYS * sizeof(float);
+constexpr float NO_KEY = std::numeric_limits<float>::infinity();
+
+static_assert(sizeof(SnapshotHeader) <= BLOCK_SIZE, "snapshot header overflows a page");
+static_assert(BLOCK_SIZE % NODE_BYTES == 0, "snapshot nodes must not straddle pages");
+
+std::uint64_t pageAligned(std::uint64_t bytes)
+{
+    return (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+}
+
+// Nodes per internal level, root first: leaf keys come in nodes of 16 and each level above has a
+// node per 17 nodes below it, up to a single root
+std::vector<std::uint64_t> levelWidths(std::uint64_t entry_count)
+{
+    std::vector<std::uint64_t> widths;
+    for (std::uint64_t width = (entry_count + SNAPSHOT_NODE_KEYS - 1) / SNAPSHOT_NODE_KEYS; width > 1;)
+    {
+        width = (width + SNAPSHOT_FANOUT - 1) / SNAPSHOT_FANOUT;
+        widths.insert(widths.begin(), width);
+    }
+    return widths;
+}
+
+// Zero bytes up to the next page boundary
+void padToPage(std::ofstream &out, std::uint64_t written)
+{
+    static const char zeros[BLOCK_SIZE] = {};
+    out.write(zeros, static_cast<std::streamsize>(pageAligned(written) - written));
+}
+
+} // namespace
+
+IndexSnapshot::IndexSnapshot(const std::string &filename)
+    : file{filename}, levelNodes{}, levels{0}, keys{nullptr}, ridBytes{nullptr}, entryCount{0}
+{
+}
+
+bool IndexSnapshot::write(const std::string &filename, const std::vector<IndexEntry> &entries)
+{
+    auto by_key = [](const IndexEntry &a, const IndexEntry &b) { return a.first < b.first; };
+    if (!std::is_sorted(entries.begin(), entries.end(), by_key))
+    {
+        std::cerr << "Snapshot entries are not sorted by key: " << filename << std::endl;
+        return false;
+    }
+
+    std::size_t leaf_nodes = (entries.size() + SNAPSHOT_NODE_KEYS - 1) / SNAPSHOT_NODE_KEYS;
+    std::vector<std::uint64_t> widths = levelWidths(entries.size());
+    if (widths.size() > MAX_SNAPSHOT_LEVELS)
+    {
+        std::cerr << "Too many entries for an index snapshot: " << entries.size() << std::endl;
+        return false;
+    }
+
+    SnapshotHeader header{};
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.block_size = static_cast<std::uint32_t>(BLOCK_SIZE);
+    header.node_keys = static_cast<std::uint32_t>(SNAPSHOT_NODE_KEYS);
+    header.entry_count = entries.size();
+    header.levels = widths.size();
+    std::uint64_t offset = BLOCK_SIZE;
+    for (std::size_t level = 0; level < widths.size(); level++)
+    {
+        header.level_offset[level] = offset;
+        header.level_nodes[level] = widths[level];
+        offset += pageAligned(widths[level] * NODE_BYTES);
+    }
+    header.keys_offset = offset;
+    header.rids_offset = offset + pageAligned(leaf_nodes * NODE_BYTES);
+
+    // A crash mid-write must leave the previous snapshot intact
+    std::string temp_filename = filename + ".tmp";
+    std::ofstream out(temp_filename, std::ios::binary);
+    if (!out.is_open())
+    {
+        std::cerr << "Failed to open snapshot file for writing: " << temp_filename << std::endl;
+        return false;
+    }
+
+    char page[BLOCK_SIZE] = {};
+    std::memcpy(page, &header, sizeof(header));
+    out.write(page, BLOCK_SIZE);
+
+    // Separator i of node j is the smallest key under child 17j + i, i.e. the first key of that
+    // child's leftmost leaf node; child 0 needs none. Children past the end get +inf and are never taken.
+    std::size_t span = 1; // leaf nodes under one child of the level being written
+    for (std::size_t level = 1; level < widths.size(); level++)
+        span *= SNAPSHOT_FANOUT;
+    for (std::size_t level = 0; level < widths.size(); level++, span /= SNAPSHOT_FANOUT)
+    {
+        std::vector<float> nodes(widths[level] * SNAPSHOT_NODE_KEYS);
+        for (std::size_t node = 0; node < widths[level]; node++)
+        {
+            for (std::size_t i = 1; i < SNAPSHOT_FANOUT; i++)
+            {
+                std::size_t leaf = (node * SNAPSHOT_FANOUT + i) * span;
+                nodes[node * SNAPSHOT_NODE_KEYS + i - 1] =
+                    leaf < leaf_nodes ? entries[leaf * SNAPSHOT_NODE_KEYS].first : NO_KEY;
+            }
+        }
+        out.write(reinterpret_cast<const char *>(nodes.data()),
+                  static_cast<std::streamsize>(nodes.size() * sizeof(float)));
+        padToPage(out, nodes.size() * sizeof(float));
+    }
+
+    // Flat key array, the last node filled up with +inf, then the RIDs in the same order
+    std::vector<float> leaf_keys(leaf_nodes * SNAPSHOT_NODE_KEYS, NO_KEY);
+    for (std::size_t i = 0; i < entries.size(); i++)
+        leaf_keys[i] = entries[i].first;
+    out.write(reinterpret_cast<const char *>(leaf_keys.data()),
+              static_cast<std::streamsize>(leaf_keys.size() * sizeof(float)));
+    padToPage(out, leaf_keys.size() * sizeof(float));
+
+    std::vector<char> packed(entries.size() * PACKED_REF_SIZE);
+    for (std::size_t i = 0; i < entries.size(); i++)
+    {
+        char *at = packed.data() + i * PACKED_REF_SIZE;
+        std::memcpy(at, &entries[i].second.block_id, sizeof(std::uint32_t));
+        std::memcpy(at + sizeof(std::uint32_t), &entries[i].second.record_offset, sizeof(std::uint16_t));
+    }
+    out.write(packed.data(), static_cast<std::streamsize>(packed.size()));
+
+    out.close();
+    if (!out)
+    {
+        std::cerr << "Failed to write snapshot file: " << temp_filename << std::endl;
+        return false;
+    }
+
+    if (!replaceFileDurably(temp_filename, filename))
+    {
+        std::cerr << "Failed to replace snapshot file: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool IndexSnapshot::open()
+{
+    if (!file.map())
+        return false;
+
+    SnapshotHeader header{};
+    if (file.size() >= BLOCK_SIZE)
+        std::memcpy(&header, file.data(), sizeof(header));
+
+    // Every section has to lie inside the mapping, and the level widths have to be the ones the implicit
+    // child numbering assumes, before any pointer into the file is handed out
+    std::uint64_t leaf_nodes = (header.entry_count + SNAPSHOT_NODE_KEYS - 1) / SNAPSHOT_NODE_KEYS;
+    std::vector<std::uint64_t> widths = levelWidths(header.entry_count);
+    bool valid = header.magic == SNAPSHOT_MAGIC && header.version == SNAPSHOT_VERSION &&
+                 header.block_size == BLOCK_SIZE && header.node_keys == SNAPSHOT_NODE_KEYS &&
+                 header.entry_count <= file.size() && header.levels == widths.size() &&
+                 header.levels <= MAX_SNAPSHOT_LEVELS && header.keys_offset % BLOCK_SIZE == 0 &&
+                 header.keys_offset + leaf_nodes * NODE_BYTES <= file.size() &&
+                 header.rids_offset + header.entry_count * PACKED_REF_SIZE <= file.size();
+    for (std::uint64_t level = 0; valid && level < header.levels; level++)
+        valid = header.level_nodes[level] == widths[level] && header.level_offset[level] % BLOCK_SIZE == 0 &&
+                header.level_offset[level] + header.level_nodes[level] * NODE_BYTES <= file.size();
+    if (!valid)
+    {
+        std::cerr << "Invalid index snapshot format" << std::endl;
+        file.unmap();
+        return false;
+    }
+
+    levels = static_cast<std::size_t>(header.levels);
+    for (std::size_t level = 0; level < levels; level++)
+        levelNodes[level] = reinterpret_cast<const float *>(file.data() + header.level_offset[level]);
+    keys = reinterpret_cast<const float *>(file.data() + header.keys_offset);
+    ridBytes = file.data() + header.rids_offset;
+    entryCount = static_cast<std::size_t>(header.entry_count);
+
+    // Lookups jump straight to the lines they need; readahead would only waste I/O
+    file.advise(AccessPattern::RANDOM);
+    return true;
+}
+
+std::size_t IndexSnapshot::position(float key, bool at_most, int *lines_read) const
+{
+    if (entryCount == 0)
+        return 0;
+    // The +inf padding must never count as at most key
+    if (at_most && !(key < NO_KEY))
+        return entryCount;
+
+    // One node per level: count its separators below key to pick the child
+    std::size_t node = 0;
+    for (std::size_t level = 0; level < levels; level++)
+    {
+        const float *separators = levelNodes[level] + node * SNAPSHOT_NODE_KEYS;
+        std::size_t child = at_most ? countKeysAtMost(separators, SNAPSHOT_NODE_KEYS, key)
+                                    : countKeysBelow(separators, SNAPSHOT_NODE_KEYS, key);
+        node = node * SNAPSHOT_FANOUT + child;
+    }
+
+    // Within the leaf node; when all of it is below key the answer is the start of the next one
+    const float *leaf = keys + node * SNAPSHOT_NODE_KEYS;
+    std::size_t pos = node * SNAPSHOT_NODE_KEYS + (at_most ? countKeysAtMost(leaf, SNAPSHOT_NODE_KEYS, key)
+                                                           : countKeysBelow(leaf, SNAPSHOT_NODE_KEYS, key));
+    if (lines_read)
+        *lines_read += static_cast<int>(levels + 1);
+    return std::min(pos, entryCount);
+}
+
+RecordRef IndexSnapshot::rid(std::size_t i) const
+{
+    const char *at = ridBytes + i * PACKED_REF_SIZE;
+    RecordRef ref;
+    std::memcpy(&ref.block_id, at, sizeof(ref.block_id));
+    std::memcpy(&ref.record_offset, at + sizeof(ref.block_id), sizeof(ref.record_offset));
+    return ref;
+}
+
+std::vector<RecordRef> IndexSnapshot::collect(std::size_t begin, std::size_t end) const
+{
+    std::vector<RecordRef> result;
+    result.reserve(end > begin ? end - begin : 0);
+    for (std::size_t i = begin; i < end; i++)
+        result.push_back(rid(i));
+    return result;
+}
+
+std::vector<RecordRef> IndexSnapshot::search(float key) const
+{
+    return collect(position(key, false), position(key, true));
+}
+
+std::vector<RecordRef> IndexSnapshot::searchRange(float min_key, float max_key) const
+{
+    if (min_key > max_key)
+        return {};
+    return collect(position(min_key, false), position(max_key, true));
+}
+
+std::vector<RecordRef> IndexSnapshot::searchGreaterThan(float key) const
+{
+    return collect(position(key, true), entryCount);
+}
+
+std::pair<std::vector<RecordRef>, int> IndexSnapshot::searchGreaterThanWithStats(float key) const
+{
+    int lines_read = 0;
+    std::size_t begin = position(key, true, &lines_read);
+
+    // Then every line the collected RIDs lie on; the RID array starts on a page, so on a line too
+    if (begin < entryCount)
+        lines_read += static_cast<int>((entryCount * PACKED_REF_SIZE - 1) / NODE_BYTES -
+                                       begin * PACKED_REF_SIZE / NODE_BYTES + 1);
+    return {collect(begin, entryCount), lines_read};
+}
@@ -0,0 +1,101 @@
+#include "index_sort.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <array>
+
+namespace
+{
+
+constexpr unsigned RADIX_BITS = 8;
+constexpr std::size_t RADIX_BUCKETS = std::size_t{1} << RADIX_BITS;
+
+} // namespace
+
+void sortIndexEntries(std::vector<IndexEntry> &entries, WorkStealingPool *workers)
+{
+    std::size_t count = entries.size();
+    if (count < RADIX_SORT_MIN_ENTRIES)
+    {
+        std::sort(entries.begin(), entries.end());
+        return;
+    }
+
+    // One contiguous slice per worker, so each part's scatter stays stable
+    std::size_t parts = workers ? std::max<std::size_t>(1, workers->size()) : 1;
+    auto partBegin = [count, parts](std::size_t part) { return count * part / parts; };
+
+    std::vector<IndexEntry> buffer(count);
+    std::vector<IndexEntry> *src = &entries;
+    std::vector<IndexEntry> *dst = &buffer;
+    std::vector<std::array<std::size_t, RADIX_BUCKETS>> offsets(parts);
+
+    for (unsigned shift = 0; shift < 32; shift += RADIX_BITS)
+    {
+        auto digit = [shift](const IndexEntry &entry) {
+            return (sortableKeyBits(entry.first) >> shift) & (RADIX_BUCKETS - 1);
+        };
+
+        runTasks(workers, parts, [&](std::size_t part) {
+            std::array<std::size_t, RADIX_BUCKETS> &histogram = offsets[part];
+            histogram.fill(0);
+            for (std::size_t i = partBegin(part); i < partBegin(part + 1); i++)
+                histogram[digit((*src)[i])]++;
+        });
+
+        // Bucket-major, part-minor prefix sums give every part its own write positions
+        std::size_t next = 0;
+        bool single_bucket = false;
+        for (std::size_t bucket = 0; bucket < RADIX_BUCKETS; bucket++)
+        {
+            std::size_t bucket_start = next;
+            for (std::size_t part = 0; part < parts; part++)
+            {
+                std::size_t in_part = offsets[part][bucket];
+                offsets[part][bucket] = next;
+                next += in_part;
+            }
+            if (next - bucket_start == count)
+                single_bucket = true;
+        }
+        if (single_bucket)
+            continue;
+
+        runTasks(workers, parts, [&](std::size_t part) {
+            std::array<std::size_t, RADIX_BUCKETS> &position = offsets[part];
+            for (std::size_t i = partBegin(part); i < partBegin(part + 1); i++)
+                (*dst)[position[digit((*src)[i])]++] = (*src)[i];
+        });
+        std::swap(src, dst);
+    }
+
+    if (src != &entries)
+        entries.swap(buffer);
+
+    // Equal keys keep their input order; order them by RecordRef like the pair comparison would.
+    // Slices are moved forward to run boundaries so no run is split between two parts.
+    std::vector<std::size_t> bounds(parts + 1, count);
+    for (std::size_t part = 0; part < parts; part++)
+    {
+        std::size_t begin = std::max(partBegin(part), part > 0 ? bounds[part - 1] : 0);
+        while (begin > 0 && begin < count &&
+               sortableKeyBits(entries[begin].first) == sortableKeyBits(entries[begin - 1].first))
+            begin++;
+        bounds[part] = begin;
+    }
+
+    runTasks(workers, parts, [&](std::size_t part) {
+        std::size_t run = bounds[part];
+        while (run < bounds[part + 1])
+        {
+            std::uint32_t key = sortableKeyBits(entries[run].first);
+            std::size_t run_end = run + 1;
+            while (run_end < bounds[part + 1] && sortableKeyBits(entries[run_end].first) == key)
+                run_end++;
+
+            auto byRef = [](const IndexEntry &a, const IndexEntry &b) { return a.second < b.second; };
+            if (!std::is_sorted(entries.begin() + run, entries.begin() + run_end, byRef))
+                std::sort(entries.begin() + run, entries.begin() + run_end, byRef);
+            run = run_end;
+        }
+    });
+}
@@ -0,0 +1,216 @@
+#include "key_search.h"
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KEY_SEARCH_X86 1
+#endif
+
+namespace
+{
+
+using CountFn = std::size_t (*)(const float *keys, std::size_t count, float key);
+
+struct KernelFns
+{
+    CountFn below;
+    CountFn at_most;
+};
+
+template <bool AtMost> bool counts(float k, float key)
+{
+    return AtMost ? k <= key : k < key;
+}
+
+// Halves [base, base + count) until at most KEY_SEARCH_WINDOW keys are left; the position is then
+// base - keys plus the matches among those. The select compiles to a conditional move, so a search
+// costs no mispredicted branches however the keys compare.
+template <bool AtMost> const float *narrow(const float *base, std::size_t &count, float key)
+{
+    while (count > KEY_SEARCH_WINDOW)
+    {
+        std::size_t half = count / 2;
+        base = counts<AtMost>(base[half - 1], key) ? base + half : base;
+        count -= half;
+    }
+    return base;
+}
+
+template <bool AtMost> std::size_t countScalar(const float *keys, std::size_t count, float key)
+{
+    const float *base = narrow<AtMost>(keys, count, key);
+    std::size_t matches = 0;
+    for (std::size_t i = 0; i < count; i++)
+        matches += counts<AtMost>(base[i], key);
+    return static_cast<std::size_t>(base - keys) + matches;
+}
+
+#ifdef KEY_SEARCH_X86
+
+#ifdef __SSE2__
+template <bool AtMost> std::size_t countSse2(const float *keys, std::size_t count, float key)
+{
+    const float *base = narrow<AtMost>(keys, count, key);
+    const __m128 k = _mm_set1_ps(key);
+
+    // A matching lane compares to all ones, -1 as an integer, so subtracting the masks counts matches
+    __m128i lanes = _mm_setzero_si128();
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(base + i);
+        lanes = _mm_sub_epi32(lanes, _mm_castps_si128(AtMost ? _mm_cmple_ps(x, k) : _mm_cmplt_ps(x, k)));
+    }
+    lanes = _mm_add_epi32(lanes, _mm_shuffle_epi32(lanes, _MM_SHUFFLE(1, 0, 3, 2)));
+    lanes = _mm_add_epi32(lanes, _mm_shuffle_epi32(lanes, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    std::size_t matches = static_cast<std::size_t>(_mm_cvtsi128_si32(lanes));
+    for (; i < count; i++)
+        matches += counts<AtMost>(base[i], key);
+    return static_cast<std::size_t>(base - keys) + matches;
+}
+#endif
+
+// Lanes past count are masked out of the load, so the window needs no scalar tail
+template <bool AtMost>
+__attribute__((target("avx2,popcnt"))) std::size_t countAvx2(const float *keys, std::size_t count, float key)
+{
+    const float *base = narrow<AtMost>(keys, count, key);
+    const __m256 k = _mm256_set1_ps(key);
+    const __m256i lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    std::size_t matches = 0;
+    for (std::size_t i = 0; i < count; i += 8)
+    {
+        __m256i lanes = _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(count - i)), lane_index);
+        __m256 x = _mm256_maskload_ps(base + i, lanes);
+        __m256 m = _mm256_and_ps(_mm256_cmp_ps(x, k, AtMost ? _CMP_LE_OQ : _CMP_LT_OQ), _mm256_castsi256_ps(lanes));
+        matches += static_cast<std::size_t>(__builtin_popcount(static_cast<unsigned>(_mm256_movemask_ps(m))));
+    }
+    return static_cast<std::size_t>(base - keys) + matches;
+}
+
+template <bool AtMost>
+__attribute__((target("avx512f,popcnt"))) std::size_t countAvx512(const float *keys, std::size_t count, float key)
+{
+    const float *base = narrow<AtMost>(keys, count, key);
+    const __m512 k = _mm512_set1_ps(key);
+
+    std::size_t matches = 0;
+    for (std::size_t i = 0; i < count; i += 16)
+    {
+        __mmask16 lanes = static_cast<__mmask16>((1u << std::min<std::size_t>(count - i, 16)) - 1);
+        __m512 x = _mm512_maskz_loadu_ps(lanes, base + i);
+        __mmask16 m = _mm512_mask_cmp_ps_mask(lanes, x, k, AtMost ? _CMP_LE_OQ : _CMP_LT_OQ);
+        matches += static_cast<std::size_t>(__builtin_popcount(m));
+    }
+    return static_cast<std::size_t>(base - keys) + matches;
+}
+
+#endif
+
+bool kernelSupported(KeySearchKernel kernel)
+{
+    switch (kernel)
+    {
+    case KeySearchKernel::SCALAR:
+        return true;
+#ifdef KEY_SEARCH_X86
+#ifdef __SSE2__
+    case KeySearchKernel::SSE2:
+        return true;
+#endif
+    case KeySearchKernel::AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    case KeySearchKernel::AVX512:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("popcnt");
+#endif
+    default:
+        return false;
+    }
+}
+
+KernelFns kernelFns(KeySearchKernel kernel)
+{
+    switch (kernel)
+    {
+#ifdef KEY_SEARCH_X86
+#ifdef __SSE2__
+    case KeySearchKernel::SSE2:
+        return {countSse2<false>, countSse2<true>};
+#endif
+    case KeySearchKernel::AVX2:
+        return {countAvx2<false>, countAvx2<true>};
+    case KeySearchKernel::AVX512:
+        return {countAvx512<false>, countAvx512<true>};
+#endif
+    default:
+        return {countScalar<false>, countScalar<true>};
+    }
+}
+
+// Every node visited goes through here, so the CPU is only asked once
+const KernelFns &detectedFns()
+{
+    static const KernelFns fns = kernelFns(detectKeySearchKernel());
+    return fns;
+}
+
+KernelFns chosenFns(KeySearchKernel kernel)
+{
+    if (kernel == KeySearchKernel::AUTO || !kernelSupported(kernel))
+        return detectedFns();
+    return kernelFns(kernel);
+}
+
+} // namespace
+
+KeySearchKernel detectKeySearchKernel()
+{
+    if (kernelSupported(KeySearchKernel::AVX512))
+        return KeySearchKernel::AVX512;
+    if (kernelSupported(KeySearchKernel::AVX2))
+        return KeySearchKernel::AVX2;
+    if (kernelSupported(KeySearchKernel::SSE2))
+        return KeySearchKernel::SSE2;
+    return KeySearchKernel::SCALAR;
+}
+
+const char *keySearchKernelName(KeySearchKernel kernel)
+{
+    switch (kernel)
+    {
+    case KeySearchKernel::AUTO:
+        return "auto";
+    case KeySearchKernel::SCALAR:
+        return "scalar";
+    case KeySearchKernel::SSE2:
+        return "SSE2";
+    case KeySearchKernel::AVX2:
+        return "AVX2";
+    case KeySearchKernel::AVX512:
+        return "AVX-512";
+    }
+    return "unknown";
+}
+
+std::size_t countKeysBelow(const float *keys, std::size_t count, float key)
+{
+    return detectedFns().below(keys, count, key);
+}
+
+std::size_t countKeysAtMost(const float *keys, std::size_t count, float key)
+{
+    return detectedFns().at_most(keys, count, key);
+}
+
+std::size_t countKeysBelow(const float *keys, std::size_t count, float key, KeySearchKernel kernel)
+{
+    return chosenFns(kernel).below(keys, count, key);
+}
+
+std::size_t countKeysAtMost(const float *keys, std::size_t count, float key, KeySearchKernel kernel)
+{
+    return chosenFns(kernel).at_most(keys, count, key);
+}
@@ -1,10 +1,15 @@
 #include "bplus_tree.h"
 #include "constants.h"
 #include "disk.h"
+#include "external_sort.h"
+#include "index_snapshot.h"
+#include "scan.h"
+#include "tsv_parser.h"
 #include "utils.h"
 #include <chrono>
 #include <iostream>
-#include <set>
+#include <string>
+#include <thread>
 
 void task3(Disk &disk);
 
@@ -14,23 +19,39 @@ void task1(const Disk &disk)
     disk.printStats();
 }
 
-void task2(const Disk &disk)
+void task2(const Disk &disk, bool index_attached, std::size_t sort_memory)
 {
     std::cout << "=== Task 2 ===" << '\n';
+
+    // An existing database keeps the index it was saved with
+    if (index_attached)
+    {
+        std::cout << "Reusing existing B+ tree index: ft_pct_home.idx" << std::endl;
+        std::cout << std::endl;
+        return;
+    }
+
     std::cout << "Building B+ tree on FT_PCT_home attribute..." << std::endl;
 
     auto start = std::chrono::high_resolution_clock::now();
 
-    BPlusTree bplus_tree(100, "ft_pct_home.idx");
+    BPlusTree bplus_tree(0, "ft_pct_home.idx");
 
     std::cout << "Building new B+ tree index..." << std::endl;
 
-    // Get all FT_PCT_home values with their record references
-    auto ft_pct_data = disk.getAllFTPctHomeValues();
-    std::cout << "Retrieved " << ft_pct_data.size() << " records for indexing" << std::endl;
+    // Stream FT_PCT_home values with their record references through an external sort, spilling
+    // sorted runs once sort_memory is used up, and build the tree bottom-up from the merged output
+    WorkStealingPool build_workers(std::max(1u, std::thread::hardware_concurrency()));
+    ExternalSorter sorter("ft_pct_home.idx.sort", sort_memory, &build_workers);
+    disk.scanIndexKeys(RecordField::FT_PCT_HOME, [&sorter](float key, const RecordRef &ref) { sorter.add({key, ref}); });
+    if (!sorter.finish())
+        return;
+    std::cout << "Retrieved " << sorter.getEntryCount() << " records for indexing (" << sorter.getRunCount()
+              << " sorted runs spilled)" << std::endl;
 
-    // Build the B+ tree using bulk loading
-    bplus_tree.bulkLoad(ft_pct_data);
+    bplus_tree.bulkLoadSorted([&sorter](IndexEntry &entry) { return sorter.next(entry); }, 1.0, &build_workers);
+    if (sorter.hasFailed())
+        return;
 
     // Save B+ tree to disk
     bplus_tree.saveToDisk();
@@ -51,13 +72,19 @@ void task3(Disk &disk)
 {
     std::cout << "\n=== Task 3: Delete records with FT_PCT_home > 0.9 ===" << std::endl;
 
-    // Load existing B+ tree from disk
-    BPlusTree bplus_tree(100, "ft_pct_home.idx");
-    bplus_tree.loadFromDisk();
+    // Open the B+ tree on disk; nodes are read into its cache as the search touches them
+    BPlusTree bplus_tree(0, "ft_pct_home.idx");
+    bplus_tree.openFromDisk();
+    bplus_tree.attachLog(disk.getLog());
 
     std::cout << "\n--- B+ Tree Statistics BEFORE Deletion ---" << std::endl;
     bplus_tree.printStatistics();
 
+    // Threads for the parallel comparison scan, started before anything in this task is timed
+    WorkStealingPool scan_workers(std::max(1u, std::thread::hardware_concurrency()));
+
+    // The buffer pool statistics printed below cover this task only, not the reads of earlier tasks
+    disk.resetPoolStats();
     auto start = std::chrono::high_resolution_clock::now();
 
     std::cout << "\nStep 1: Using B+ tree index to find records with FT_PCT_home > 0.9..." << std::endl;
@@ -80,21 +107,15 @@ void task3(Disk &disk)
 
     std::cout << "\nStep 3: Retrieving actual records from disk using RecordRef pointers..." << std::endl;
 
-    // Count unique blocks accessed for statistics
-    std::set<std::uint32_t> unique_blocks;
-    for (const auto &ref : record_refs)
-    {
-        unique_blocks.insert(ref.block_id);
-    }
-
-    std::cout << "Number of data blocks to access: " << unique_blocks.size() << std::endl;
-
-    // Retrieve actual records from disk (NOT from memory!)
+    // Retrieve actual records from disk (NOT from memory!), one read per distinct block
     auto disk_read_start = std::chrono::high_resolution_clock::now();
-    auto records = disk.getRecords(record_refs);
+    auto [records, blocks_accessed] = disk.getRecordsWithStats(record_refs);
     auto disk_read_end = std::chrono::high_resolution_clock::now();
     auto disk_time = std::chrono::duration_cast<std::chrono::microseconds>(disk_read_end - disk_read_start).count();
+    // Retrieval is the index search plus the record fetch; the scans and deletion below are timed on their own
+    auto retrieval_time = std::chrono::duration_cast<std::chrono::milliseconds>(disk_read_end - start).count();
 
+    std::cout << "Number of data blocks accessed: " << blocks_accessed << std::endl;
     std::cout << "Disk retrieval time: " << disk_time << " microseconds" << std::endl;
 
     // Calculate statistics BEFORE deletion
@@ -123,69 +144,319 @@ void task3(Disk &disk)
         }
     }
 
-    // Step 5: PERFORM ACTUAL DELETION
-    std::cout << "\nStep 5: Deleting records from disk and B+ tree index..." << std::endl;
+    // Step 5: the same query as a full-table scan, measured while the records still exist
+    std::cout << "\nStep 5: Scanning every data block for FT_PCT_home > 0.9 for comparison..." << std::endl;
+
+    // Brute force reads every block; the zone map is left to the parallel scan below
+    ScanOperator scan({RecordField::FT_PCT_HOME, CompareOp::GT, 0.9});
+    scan.setZonePruning(false);
+    std::vector<Record> scanned;
+    auto scan_start = std::chrono::high_resolution_clock::now();
+    ScanStats scan_stats =
+        scan.run(disk, [&scanned](const Record &record, const RecordRef &) { scanned.push_back(record); });
+    auto scan_end = std::chrono::high_resolution_clock::now();
+    auto scan_time = std::chrono::duration_cast<std::chrono::microseconds>(scan_end - scan_start).count();
+
+    std::cout << "Linear scan found " << scan_stats.rows_matched << " records" << std::endl;
+    if (scan_stats.rows_matched != record_refs.size())
+        std::cerr << "Linear scan and index disagree: " << scan_stats.rows_matched << " vs " << record_refs.size()
+                  << '\n';
+
+    // Same predicate split across every core, aggregating the average without assembling rows
+    ScanStats parallel_stats;
+    auto parallel_start = std::chrono::high_resolution_clock::now();
+    ScanOperator pruned_scan({RecordField::FT_PCT_HOME, CompareOp::GT, 0.9});
+    ColumnSummary scan_summary =
+        pruned_scan.aggregateParallel(disk, RecordField::FT_PCT_HOME, scan_workers, &parallel_stats);
+    auto parallel_end = std::chrono::high_resolution_clock::now();
+    auto parallel_time = std::chrono::duration_cast<std::chrono::microseconds>(parallel_end - parallel_start).count();
+
+    std::cout << "Parallel scan on " << scan_workers.size() << " threads found " << scan_summary.count
+              << " records, average FT_PCT_home "
+              << (scan_summary.count > 0 ? scan_summary.sum / scan_summary.count : 0.0) << std::endl;
+
+    // Step 6: PERFORM ACTUAL DELETION
+    std::cout << "\nStep 6: Deleting records from disk and B+ tree index..." << std::endl;
 
     auto deletion_start = std::chrono::high_resolution_clock::now();
 
     // Delete from disk
-    int disk_deleted = disk.deleteRecords(record_refs);
-    std::cout << "Deleted " << disk_deleted << " records from disk" << std::endl;
+    // One read-modify-write per affected block; without a log, a single sync at the end
+    auto [disk_deleted, blocks_written] = disk.deleteRecordsWithStats(record_refs, disk.getLog() == nullptr);
+    std::cout << "Deleted " << disk_deleted << " records from disk (" << blocks_written << " blocks rewritten)"
+              << std::endl;
 
     // Delete from B+ tree index
     int index_deleted = bplus_tree.deleteGreaterThan(0.9f);
     std::cout << "Deleted " << index_deleted << " entries from B+ tree index" << std::endl;
 
+    // Both deletions become durable together through the log
+    if (const WriteAheadLog *wal = disk.getLog())
+    {
+        disk.commitLog();
+        std::cout << "Write-ahead log: " << wal->getAppendCount() << " records, " << wal->getSyncCount()
+                  << " syncs" << std::endl;
+    }
+
     auto deletion_end = std::chrono::high_resolution_clock::now();
     auto deletion_time = std::chrono::duration_cast<std::chrono::milliseconds>(deletion_end - deletion_start).count();
 
-    auto total_end = std::chrono::high_resolution_clock::now();
-    auto total_time = std::chrono::duration_cast<std::chrono::milliseconds>(total_end - start).count();
-
     std::cout << "\n=== Task 3 Results ===" << std::endl;
     std::cout << "Number of index nodes accessed: " << index_nodes_accessed << std::endl;
-    std::cout << "Number of data blocks accessed: " << unique_blocks.size() << std::endl;
+    std::cout << "Number of data blocks accessed: " << blocks_accessed << std::endl;
     std::cout << "Number of games deleted: " << valid_records << std::endl;
     std::cout << "Average FT_PCT_home of deleted records: " << (valid_records > 0 ? total_ft_pct / valid_records : 0.0f)
               << std::endl;
-    std::cout << "Running time of retrieval process: " << total_time << " ms" << std::endl;
+    std::cout << "Running time of retrieval process: " << retrieval_time << " ms" << std::endl;
     std::cout << "Running time of deletion process: " << deletion_time << " ms" << std::endl;
 
-    // Compare with brute-force linear scan
+    if (disk.getBackend() == StorageBackend::BUFFER_POOL)
+    {
+        std::cout << std::endl;
+        disk.getBufferPool().printStatistics();
+    }
+
+    // Compare with the brute-force linear scan measured in step 5
+    auto index_path_time = index_time + disk_time;
     std::cout << "\n=== Brute-force Comparison ===" << std::endl;
-    std::cout << "Linear scan would access: " << disk.getTtlBlks() << " data blocks" << std::endl;
-    std::cout << "Linear scan estimated time: ~" << (disk.getTtlBlks() * 5) << " ms (estimated)" << std::endl;
-    std::cout << "Assumption: 5 ms per block access and scan" << std::endl;
-    std::cout << "Index speedup: ~" << (float)(disk.getTtlBlks() * 5) / std::max(1, (int)total_time) << "x faster"
-              << std::endl;
+    std::cout << "Linear scan accessed: " << scan_stats.blocks_read << " data blocks" << std::endl;
+    std::cout << "Linear scan time: " << scan_time << " microseconds (measured, " << scanKernelName(scan.getKernel())
+              << " kernel)" << std::endl;
+    std::cout << "Parallel scan time: " << parallel_time << " microseconds (" << scan_workers.size()
+              << " threads, " << parallel_stats.blocks_read << " blocks read, " << parallel_stats.blocks_skipped
+              << " skipped by zone maps)" << std::endl;
+    std::cout << "Index search + retrieval time: " << index_path_time << " microseconds" << std::endl;
+    std::cout << "Index speedup: ~" << (double)scan_time / std::max<long long>(1, index_path_time) << "x" << std::endl;
 
     // Show updated B+ tree statistics
     std::cout << "\n--- B+ Tree Statistics AFTER Deletion ---" << std::endl;
     bplus_tree.printStatistics();
 
-    // Save updated B+ tree to disk
-    bplus_tree.saveToDisk();
-    std::cout << "\nUpdated B+ tree index saved to disk." << std::endl;
+    // Save updated B+ tree and data.db, after which the log can be emptied
+    if (disk.checkpoint(&bplus_tree))
+        std::cout << "\nUpdated B+ tree index saved to disk." << std::endl;
+}
+
+// Inserts the rows of a file in games.txt format (header line first) into data.db, keeping the index in step
+void feedRecords(Disk &disk, const std::string &feed_file)
+{
+    std::cout << "\n=== Inserting records from " << feed_file << " ===" << std::endl;
+
+    TsvReader reader(feed_file);
+    if (!reader.isOpen())
+    {
+        std::cerr << "Cannot open feed file: " << feed_file << '\n';
+        return;
+    }
+    std::string_view header;
+    reader.nextLine(header);
+
+    std::vector<Record> records;
+    Record rec;
+    while (reader.next(rec))
+        records.push_back(rec);
+
+    BPlusTree bplus_tree(0, "ft_pct_home.idx");
+    if (!bplus_tree.openFromDisk())
+        return;
+    bplus_tree.attachLog(disk.getLog());
+    disk.registerIndex(&bplus_tree);
+
+    // Free slots left by deletions are filled first, the rest goes into new blocks
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<RecordRef> refs = disk.insertRecords(records);
+    bool committed = disk.commitLog();
+    auto end = std::chrono::high_resolution_clock::now();
+    disk.unregisterIndex(&bplus_tree);
+
+    std::cout << "Inserted " << refs.size() << " of " << records.size() << " records in "
+              << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " microseconds"
+              << std::endl;
+    std::cout << "FT_PCT_home > 0.9 now matches " << bplus_tree.searchGreaterThan(0.9f).size() << " records"
+              << std::endl;
+
+    if (committed && disk.checkpoint(&bplus_tree))
+        std::cout << "Updated B+ tree index saved to disk." << std::endl;
 }
 
-int main()
+// Range predicates that per-block zone maps can answer without reading most of data.db
+void zoneMapDemo(const Disk &disk)
 {
-    Disk disk("data/data.db");
-    std::cout << "Creating database from " << DATA_FILE << '\n';
-    if (!disk.loadData())
+    std::cout << "\n=== Zone Maps ===" << std::endl;
+
+    struct Query
+    {
+        const char *label;
+        ScanPredicate predicate;
+    };
+    const Query queries[] = {
+        {"Games between 01/10/2010 and 30/06/2011",
+         {RecordField::GAME_DATE_EST, CompareOp::BETWEEN, (double)dateToInt_2Byte("01/10/2010"),
+          (double)dateToInt_2Byte("30/06/2011")}},
+        {"Games with PTS_home >= 150", {RecordField::PTS_HOME, CompareOp::GE, 150}},
+    };
+
+    for (const auto &query : queries)
+    {
+        ScanOperator scan(query.predicate);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        ScanStats stats;
+        std::vector<RecordRef> refs = scan.collectRefs(disk, &stats);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        std::cout << query.label << ": " << refs.size() << " records, " << stats.blocks_read << " blocks read, "
+                  << stats.blocks_skipped << " skipped, "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " microseconds"
+                  << std::endl;
+    }
+}
+
+// The saved index frozen into a read-only snapshot, queried side by side with the B+ tree
+void snapshotDemo()
+{
+    std::cout << "\n=== Index Snapshot ===" << std::endl;
+
+    BPlusTree bplus_tree(0, "ft_pct_home.idx");
+    if (!bplus_tree.openFromDisk() || !bplus_tree.freeze("ft_pct_home.idx.snap"))
+        return;
+
+    auto open_start = std::chrono::high_resolution_clock::now();
+    IndexSnapshot snapshot("ft_pct_home.idx.snap");
+    if (!snapshot.open())
+        return;
+    auto open_end = std::chrono::high_resolution_clock::now();
+    std::cout << "Snapshot mapped in "
+              << std::chrono::duration_cast<std::chrono::microseconds>(open_end - open_start).count()
+              << " microseconds: " << snapshot.size() << " entries, " << snapshot.getLevels() << " internal levels"
+              << std::endl;
+
+    for (float key : {0.5f, 0.8f})
     {
-        return 1;
+        auto tree_start = std::chrono::high_resolution_clock::now();
+        auto [tree_refs, tree_nodes] = bplus_tree.searchGreaterThanWithStats(key);
+        auto tree_end = std::chrono::high_resolution_clock::now();
+        auto [snapshot_refs, snapshot_lines] = snapshot.searchGreaterThanWithStats(key);
+        auto snapshot_end = std::chrono::high_resolution_clock::now();
+
+        // The tree reads whole pages, the snapshot single cache lines of keys and RIDs
+        std::cout << "FT_PCT_home > " << key << ": B+ tree " << tree_refs.size() << " records, " << tree_nodes
+                  << " pages, " << std::chrono::duration_cast<std::chrono::microseconds>(tree_end - tree_start).count()
+                  << " microseconds; snapshot " << snapshot_refs.size() << " records, " << snapshot_lines
+                  << " cache lines, "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(snapshot_end - tree_end).count()
+                  << " microseconds" << std::endl;
+        if (tree_refs != snapshot_refs)
+            std::cerr << "Snapshot and B+ tree disagree on FT_PCT_home > " << key << '\n';
+    }
+
+    // Point lookups over the whole key range, where the snapshot's one line per level pays off
+    std::size_t tree_found = 0;
+    std::size_t snapshot_found = 0;
+    auto tree_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i <= 1000; i++)
+        tree_found += bplus_tree.search(i / 1000.0f).size();
+    auto tree_end = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i <= 1000; i++)
+        snapshot_found += snapshot.search(i / 1000.0f).size();
+    auto snapshot_end = std::chrono::high_resolution_clock::now();
+
+    std::cout << "1001 point lookups: B+ tree "
+              << std::chrono::duration_cast<std::chrono::microseconds>(tree_end - tree_start).count()
+              << " microseconds, snapshot "
+              << std::chrono::duration_cast<std::chrono::microseconds>(snapshot_end - tree_end).count()
+              << " microseconds (" << snapshot_found << " records)" << std::endl;
+    if (tree_found != snapshot_found)
+        std::cerr << "Snapshot and B+ tree disagree on point lookups: " << snapshot_found << " vs " << tree_found
+                  << '\n';
+}
+
+int main(int argc, char *argv[])
+{
+    DiskOptions options;
+    options.write_ahead_log = true;
+    bool rebuild = false;
+    std::size_t sort_memory = DEFAULT_SORT_MEMORY;
+    std::string feed_file;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--mmap")
+            options.backend = StorageBackend::MMAP;
+        else if (arg == "--no-wal")
+            options.write_ahead_log = false;
+        else if (arg == "--pax")
+            options.layout = PageLayout::PAX;
+        else if (arg == "--rebuild")
+            rebuild = true;
+        else if (arg == "--async")
+            options.async_queue_depth = 32;
+        else if (arg == "--threads" && i + 1 < argc)
+            options.ingest_threads = static_cast<unsigned>(std::stoul(argv[++i]));
+        else if (arg == "--sort-memory" && i + 1 < argc)
+            sort_memory = static_cast<std::size_t>(std::stoul(argv[++i])) << 10;
+        else if (arg == "--feed" && i + 1 < argc)
+            feed_file = argv[++i];
+        else
+        {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--mmap] [--pax] [--async] [--threads N] [--sort-memory KiB] [--no-wal] [--rebuild]"
+                      << " [--feed FILE]" << '\n';
+            return 1;
+        }
+    }
+
+    Disk disk("data/data.db", options);
+
+    // Reuse the database from an earlier run unless asked to start over
+    auto open_start = std::chrono::high_resolution_clock::now();
+    bool opened = !rebuild && disk.open();
+    if (opened)
+    {
+        auto open_end = std::chrono::high_resolution_clock::now();
+        std::cout << "Opened existing database data/data.db in "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(open_end - open_start).count()
+                  << " microseconds (use --rebuild to reload " << DATA_FILE << ")" << '\n';
+    }
+    else
+    {
+        std::cout << "Creating database from " << DATA_FILE << '\n';
+        if (!disk.loadData())
+        {
+            return 1;
+        }
+    }
+
+    // Reattach the index and redo the log against both before anything reads them
+    bool index_attached = false;
+    if (opened)
+    {
+        BPlusTree index(0, "ft_pct_home.idx");
+        index_attached = index.openFromDisk();
+
+        std::size_t replayed = disk.recover(index_attached ? &index : nullptr);
+        if (replayed > 0)
+        {
+            std::cout << "Replayed " << replayed << " write-ahead log records" << '\n';
+            disk.checkpoint(index_attached ? &index : nullptr);
+        }
     }
 
     task1(disk);
-    task2(disk);
+    task2(disk, index_attached, sort_memory);
 
     // Demonstrate index-based data retrieval
-    BPlusTree demo_tree(100, "ft_pct_home.idx");
-    demo_tree.loadFromDisk();
+    BPlusTree demo_tree(0, "ft_pct_home.idx");
+    demo_tree.openFromDisk();
 
     // Task 3 demonstration
     task3(disk);
 
+    if (!feed_file.empty())
+        feedRecords(disk, feed_file);
+
+    zoneMapDemo(disk);
+    snapshotDemo();
+
     return 0;
 }
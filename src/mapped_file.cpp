@@ -0,0 +1,94 @@
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string &filename, bool writable)
+    : filename{filename}, writable{writable}, fd{-1}, base{nullptr}, length{0}, pattern{AccessPattern::NORMAL}
+{
+}
+
+MappedFile::~MappedFile()
+{
+    unmap();
+}
+
+bool MappedFile::map()
+{
+    unmap();
+
+    fd = ::open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Cannot open file for mapping: " << filename << '\n';
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        std::cerr << "Cannot stat file for mapping: " << filename << '\n';
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    if (st.st_size == 0)
+    {
+        // Nothing to map yet, the caller sees an empty mapping
+        ::close(fd);
+        fd = -1;
+        return true;
+    }
+
+    int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void *addr = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), prot, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        std::cerr << "Cannot map file: " << filename << '\n';
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    base = static_cast<char *>(addr);
+    length = static_cast<std::size_t>(st.st_size);
+    advise(pattern);
+    return true;
+}
+
+void MappedFile::unmap()
+{
+    if (base)
+        ::munmap(base, length);
+    if (fd >= 0)
+        ::close(fd);
+
+    base = nullptr;
+    length = 0;
+    fd = -1;
+}
+
+void MappedFile::advise(AccessPattern pattern) const
+{
+    this->pattern = pattern;
+    if (!base)
+        return;
+
+    int advice = MADV_NORMAL;
+    if (pattern == AccessPattern::SEQUENTIAL)
+        advice = MADV_SEQUENTIAL;
+    else if (pattern == AccessPattern::RANDOM)
+        advice = MADV_RANDOM;
+
+    ::madvise(base, length, advice);
+}
+
+bool MappedFile::sync() const
+{
+    if (!base || !writable)
+        return true;
+    return ::msync(base, length, MS_SYNC) == 0;
+}
@@ -0,0 +1,384 @@
+#include "scan.h"
+#include "page.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+namespace
+{
+
+template <typename T> bool matches(T v, CompareOp op, T low, T high)
+{
+    switch (op)
+    {
+    case CompareOp::LT:
+        return v < low;
+    case CompareOp::LE:
+        return v <= low;
+    case CompareOp::GT:
+        return v > low;
+    case CompareOp::GE:
+        return v >= low;
+    case CompareOp::EQ:
+        return v == low;
+    case CompareOp::BETWEEN:
+        return v >= low && v <= high;
+    }
+    return false;
+}
+
+// The kernels below set bit i of mask when values[i] matches. mask must start zeroed; the SIMD
+// kernels overwrite whole bytes and leave any tail of fewer than eight values to this one.
+void compareFloatsScalar(const float *values, std::size_t n, CompareOp op, float low, float high, std::uint8_t *mask)
+{
+    for (std::size_t i = 0; i < n; i++)
+        if (matches(values[i], op, low, high))
+            mask[i / 8] |= static_cast<std::uint8_t>(1u << (i % 8));
+}
+
+#ifdef SCAN_X86
+
+#ifdef __SSE2__
+void compareFloatsSse2(const float *values, std::size_t n, CompareOp op, float low, float high, std::uint8_t *mask)
+{
+    const __m128 lo = _mm_set1_ps(low);
+    const __m128 hi = _mm_set1_ps(high);
+
+    auto compare = [&](__m128 x) {
+        switch (op)
+        {
+        case CompareOp::LT:
+            return _mm_cmplt_ps(x, lo);
+        case CompareOp::LE:
+            return _mm_cmple_ps(x, lo);
+        case CompareOp::GT:
+            return _mm_cmpgt_ps(x, lo);
+        case CompareOp::GE:
+            return _mm_cmpge_ps(x, lo);
+        case CompareOp::EQ:
+            return _mm_cmpeq_ps(x, lo);
+        case CompareOp::BETWEEN:
+            return _mm_and_ps(_mm_cmpge_ps(x, lo), _mm_cmple_ps(x, hi));
+        }
+        return _mm_setzero_ps();
+    };
+
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        int low_bits = _mm_movemask_ps(compare(_mm_loadu_ps(values + i)));
+        int high_bits = _mm_movemask_ps(compare(_mm_loadu_ps(values + i + 4)));
+        mask[i / 8] = static_cast<std::uint8_t>(low_bits | (high_bits << 4));
+    }
+    compareFloatsScalar(values + i, n - i, op, low, high, mask + i / 8);
+}
+#endif
+
+// Lambdas do not inherit the target attribute, so the comparison is spelled out inline
+__attribute__((target("avx2"))) void compareFloatsAvx2(const float *values, std::size_t n, CompareOp op, float low,
+                                                       float high, std::uint8_t *mask)
+{
+    const __m256 lo = _mm256_set1_ps(low);
+    const __m256 hi = _mm256_set1_ps(high);
+
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(values + i);
+        __m256 m;
+        switch (op)
+        {
+        case CompareOp::LT:
+            m = _mm256_cmp_ps(x, lo, _CMP_LT_OQ);
+            break;
+        case CompareOp::LE:
+            m = _mm256_cmp_ps(x, lo, _CMP_LE_OQ);
+            break;
+        case CompareOp::GT:
+            m = _mm256_cmp_ps(x, lo, _CMP_GT_OQ);
+            break;
+        case CompareOp::GE:
+            m = _mm256_cmp_ps(x, lo, _CMP_GE_OQ);
+            break;
+        case CompareOp::EQ:
+            m = _mm256_cmp_ps(x, lo, _CMP_EQ_OQ);
+            break;
+        default:
+            m = _mm256_and_ps(_mm256_cmp_ps(x, lo, _CMP_GE_OQ), _mm256_cmp_ps(x, hi, _CMP_LE_OQ));
+            break;
+        }
+        mask[i / 8] = static_cast<std::uint8_t>(_mm256_movemask_ps(m));
+    }
+    compareFloatsScalar(values + i, n - i, op, low, high, mask + i / 8);
+}
+
+#endif
+
+void mergeSummary(ColumnSummary &into, const ColumnSummary &part)
+{
+    if (part.count == 0)
+        return;
+
+    if (into.count == 0 || part.min < into.min)
+        into.min = part.min;
+    if (into.count == 0 || part.max > into.max)
+        into.max = part.max;
+    into.sum += part.sum;
+    into.count += part.count;
+}
+
+std::size_t morselCount(const Disk &disk)
+{
+    return (static_cast<std::size_t>(disk.getTtlBlks()) + SCAN_MORSEL_BLOCKS - 1) / SCAN_MORSEL_BLOCKS;
+}
+
+std::uint32_t morselBegin(std::size_t morsel)
+{
+    return static_cast<std::uint32_t>(morsel * SCAN_MORSEL_BLOCKS);
+}
+
+bool kernelSupported(ScanKernel kernel)
+{
+    switch (kernel)
+    {
+    case ScanKernel::SCALAR:
+        return true;
+#ifdef SCAN_X86
+#ifdef __SSE2__
+    case ScanKernel::SSE2:
+        return true;
+#endif
+    case ScanKernel::AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+} // namespace
+
+ScanKernel detectScanKernel()
+{
+    if (kernelSupported(ScanKernel::AVX2))
+        return ScanKernel::AVX2;
+    if (kernelSupported(ScanKernel::SSE2))
+        return ScanKernel::SSE2;
+    return ScanKernel::SCALAR;
+}
+
+const char *scanKernelName(ScanKernel kernel)
+{
+    switch (kernel)
+    {
+    case ScanKernel::AUTO:
+        return "auto";
+    case ScanKernel::SCALAR:
+        return "scalar";
+    case ScanKernel::SSE2:
+        return "SSE2";
+    case ScanKernel::AVX2:
+        return "AVX2";
+    }
+    return "unknown";
+}
+
+ScanOperator::ScanOperator(const ScanPredicate &predicate, ScanKernel kernel)
+    : predicate{predicate}, kernel{kernel}, zonePruning{true}
+{
+    if (this->kernel == ScanKernel::AUTO || !kernelSupported(this->kernel))
+        this->kernel = detectScanKernel();
+}
+
+std::size_t ScanOperator::matchBlock(const Block &block, std::uint8_t *mask) const
+{
+    std::memset(mask, 0, PAGE_BITMAP_SIZE);
+
+    const PageHeader *header = pageHeader(block);
+    std::size_t n = header->slot_count;
+    if (header->live_count == 0)
+        return 0;
+
+    if (isFloatField(predicate.field))
+    {
+        // Line the column up in one array: a single copy of the minipage on PAX pages,
+        // a strided gather on row pages. Zeroed so the slots past n are defined for the optimizer
+        float values[MAX_RECORDS_PER_BLOCK] = {};
+        if (const char *column = columnData(block, predicate.field))
+        {
+            std::memcpy(values, column, n * sizeof(float));
+        }
+        else
+        {
+            for (std::size_t slot = 0; slot < n; slot++)
+                values[slot] = readField<float>(block, predicate.field, slot);
+        }
+
+        float low = static_cast<float>(predicate.value);
+        float high = static_cast<float>(predicate.high);
+        switch (kernel)
+        {
+#ifdef SCAN_X86
+        case ScanKernel::AVX2:
+            compareFloatsAvx2(values, n, predicate.op, low, high, mask);
+            break;
+#ifdef __SSE2__
+        case ScanKernel::SSE2:
+            compareFloatsSse2(values, n, predicate.op, low, high, mask);
+            break;
+#endif
+#endif
+        default:
+            compareFloatsScalar(values, n, predicate.op, low, high, mask);
+            break;
+        }
+    }
+    else
+    {
+        for (std::size_t slot = 0; slot < n; slot++)
+            if (matches(readFieldAsDouble(block, predicate.field, slot), predicate.op, predicate.value, predicate.high))
+                mask[slot / 8] |= static_cast<std::uint8_t>(1u << (slot % 8));
+    }
+
+    // Tombstoned slots still hold their old values
+    const std::uint8_t *bitmap = pageBitmap(block);
+    std::size_t matched = 0;
+    for (std::size_t byte = 0; byte * 8 < n; byte++)
+    {
+        mask[byte] &= bitmap[byte];
+        matched += static_cast<std::size_t>(__builtin_popcount(mask[byte]));
+    }
+    return matched;
+}
+
+ScanStats ScanOperator::run(const Disk &disk, const RecordSink &on_match) const
+{
+    ScanStats stats;
+    std::uint8_t mask[PAGE_BITMAP_SIZE];
+
+    stats.blocks_read = disk.scanBlocks(
+        [&](std::uint32_t block_id, const Block &block) {
+            if (matchBlock(block, mask) == 0)
+                return;
+
+            forEachSetBit(mask, pageHeader(block)->slot_count, [&](std::size_t slot) {
+                on_match(readSlot(block, slot), RecordRef(block_id, static_cast<std::uint16_t>(slot)));
+                stats.rows_matched++;
+            });
+        },
+        pruneWith());
+    stats.blocks_skipped = static_cast<std::size_t>(disk.getTtlBlks()) - stats.blocks_read;
+
+    return stats;
+}
+
+std::vector<RecordRef> ScanOperator::collectRefs(const Disk &disk, ScanStats *stats) const
+{
+    std::vector<RecordRef> refs;
+    ScanStats local;
+    std::uint8_t mask[PAGE_BITMAP_SIZE];
+
+    local.blocks_read = disk.scanBlocks(
+        [&](std::uint32_t block_id, const Block &block) {
+            if (matchBlock(block, mask) == 0)
+                return;
+
+            forEachSetBit(mask, pageHeader(block)->slot_count,
+                          [&](std::size_t slot) { refs.emplace_back(block_id, static_cast<std::uint16_t>(slot)); });
+        },
+        pruneWith());
+
+    local.blocks_skipped = static_cast<std::size_t>(disk.getTtlBlks()) - local.blocks_read;
+    local.rows_matched = refs.size();
+    if (stats)
+        *stats = local;
+    return refs;
+}
+
+std::vector<RecordRef> ScanOperator::collectRefsParallel(const Disk &disk, WorkStealingPool &workers, bool ordered,
+                                                         ScanStats *stats) const
+{
+    std::size_t morsels = morselCount(disk);
+
+    // Matches are kept per morsel when order matters, per worker otherwise
+    std::vector<std::vector<RecordRef>> parts(ordered ? morsels : workers.size());
+    std::vector<std::size_t> blocks_read(workers.size(), 0);
+
+    workers.parallelFor(morsels, [&](std::size_t morsel, unsigned worker) {
+        std::vector<RecordRef> &out = parts[ordered ? morsel : worker];
+        std::uint8_t mask[PAGE_BITMAP_SIZE];
+
+        blocks_read[worker] += disk.scanBlockRange(
+            morselBegin(morsel), morselBegin(morsel + 1),
+            [&](std::uint32_t block_id, const Block &block) {
+                if (matchBlock(block, mask) == 0)
+                    return;
+
+                forEachSetBit(mask, pageHeader(block)->slot_count, [&](std::size_t slot) {
+                    out.emplace_back(block_id, static_cast<std::uint16_t>(slot));
+                });
+            },
+            pruneWith());
+    });
+
+    std::vector<RecordRef> refs;
+    ScanStats local;
+    for (const auto &part : parts)
+        refs.insert(refs.end(), part.begin(), part.end());
+    for (std::size_t count : blocks_read)
+        local.blocks_read += count;
+    local.blocks_skipped = static_cast<std::size_t>(disk.getTtlBlks()) - local.blocks_read;
+    local.rows_matched = refs.size();
+
+    if (stats)
+        *stats = local;
+    return refs;
+}
+
+ColumnSummary ScanOperator::aggregateParallel(const Disk &disk, RecordField field, WorkStealingPool &workers,
+                                              ScanStats *stats) const
+{
+    std::size_t morsels = morselCount(disk);
+    std::vector<ColumnSummary> partials(morsels);
+    std::vector<std::size_t> blocks_read(workers.size(), 0);
+
+    workers.parallelFor(morsels, [&](std::size_t morsel, unsigned worker) {
+        ColumnSummary &partial = partials[morsel];
+        std::uint8_t mask[PAGE_BITMAP_SIZE];
+
+        blocks_read[worker] += disk.scanBlockRange(
+            morselBegin(morsel), morselBegin(morsel + 1),
+            [&](std::uint32_t, const Block &block) {
+                if (matchBlock(block, mask) == 0)
+                    return;
+
+                forEachSetBit(mask, pageHeader(block)->slot_count, [&](std::size_t slot) {
+                    double value = readFieldAsDouble(block, field, slot);
+                    if (partial.count == 0 || value < partial.min)
+                        partial.min = value;
+                    if (partial.count == 0 || value > partial.max)
+                        partial.max = value;
+                    partial.sum += value;
+                    partial.count++;
+                });
+            },
+            pruneWith());
+    });
+
+    ColumnSummary summary;
+    for (const auto &partial : partials)
+        mergeSummary(summary, partial);
+
+    if (stats)
+    {
+        *stats = ScanStats{};
+        for (std::size_t count : blocks_read)
+            stats->blocks_read += count;
+        stats->blocks_skipped = static_cast<std::size_t>(disk.getTtlBlks()) - stats->blocks_read;
+        stats->rows_matched = summary.count;
+    }
+    return summary;
+}
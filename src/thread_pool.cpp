@@ -0,0 +1,183 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(std::size_t num_threads) : running{0}, stopping{false}
+{
+    if (num_threads == 0)
+        num_threads = 1;
+
+    workers.reserve(num_threads);
+    for (std::size_t i = 0; i < num_threads; i++)
+        workers.emplace_back([this] { workerLoop(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopping = true;
+    }
+    taskReady.notify_all();
+
+    for (auto &worker : workers)
+        worker.join();
+}
+
+void ThreadPool::workerLoop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskReady.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+            if (tasks.empty())
+                return; // stopping and fully drained
+
+            task = std::move(tasks.front());
+            tasks.pop();
+            running++;
+        }
+
+        task();
+
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            running--;
+            if (tasks.empty() && running == 0)
+                allDone.notify_all();
+        }
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        tasks.push(std::move(task));
+    }
+    taskReady.notify_one();
+}
+
+void ThreadPool::waitIdle()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    allDone.wait(lock, [this] { return tasks.empty() && running == 0; });
+}
+
+WorkStealingPool::WorkStealingPool(std::size_t num_threads)
+    : job{nullptr}, generation{0}, pending{0}, stopping{false}
+{
+    if (num_threads == 0)
+        num_threads = 1;
+
+    for (std::size_t i = 0; i < num_threads; i++)
+        queues.push_back(std::make_unique<TaskQueue>());
+
+    workers.reserve(num_threads);
+    for (std::size_t i = 0; i < num_threads; i++)
+        workers.emplace_back([this, i] { workerLoop(static_cast<unsigned>(i)); });
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopping = true;
+    }
+    jobReady.notify_all();
+
+    for (auto &worker : workers)
+        worker.join();
+}
+
+bool WorkStealingPool::nextTask(unsigned worker, std::size_t &task)
+{
+    {
+        TaskQueue &own = *queues[worker];
+        std::lock_guard<std::mutex> guard(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    for (std::size_t i = 1; i < queues.size(); i++)
+    {
+        TaskQueue &victim = *queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::workerLoop(unsigned worker)
+{
+    std::size_t seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobReady.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+
+        // job was set before the queues were filled, so the queue lock makes it visible here
+        std::size_t task;
+        while (nextTask(worker, task))
+        {
+            (*job)(task, worker);
+
+            if (pending.fetch_sub(1) == 1)
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                jobDone.notify_all();
+            }
+        }
+    }
+}
+
+void WorkStealingPool::parallelFor(std::size_t num_tasks,
+                                   const std::function<void(std::size_t task, unsigned worker)> &fn)
+{
+    if (num_tasks == 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        job = &fn;
+        pending = num_tasks;
+
+        for (std::size_t w = 0; w < queues.size(); w++)
+        {
+            std::lock_guard<std::mutex> queue_guard(queues[w]->mutex);
+            for (std::size_t task = num_tasks * w / queues.size(); task < num_tasks * (w + 1) / queues.size(); task++)
+                queues[w]->tasks.push_back(task);
+        }
+        generation++;
+    }
+    jobReady.notify_all();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    jobDone.wait(lock, [this] { return pending == 0; });
+}
+
+void runTasks(WorkStealingPool *workers, std::size_t num_tasks, const std::function<void(std::size_t task)> &fn)
+{
+    if (!workers || num_tasks == 1)
+    {
+        for (std::size_t task = 0; task < num_tasks; task++)
+            fn(task);
+        return;
+    }
+    workers->parallelFor(num_tasks, [&fn](std::size_t task, unsigned) { fn(task); });
+}
@@ -0,0 +1,177 @@
+#include "tsv_parser.h"
+#include "utils.h"
+#include <charconv>
+#include <cstring>
+
+namespace
+{
+
+// Cuts the next tab-delimited field off the front of rest
+std::string_view nextField(std::string_view &rest)
+{
+    const char *tab = static_cast<const char *>(std::memchr(rest.data(), '\t', rest.size()));
+    if (!tab)
+    {
+        std::string_view field = rest;
+        rest = {};
+        return field;
+    }
+
+    std::string_view field(rest.data(), static_cast<std::size_t>(tab - rest.data()));
+    rest.remove_prefix(field.size() + 1);
+    return field;
+}
+
+template <typename T> T toUnsigned(std::string_view field)
+{
+    unsigned long value = 0;
+    std::from_chars(field.data(), field.data() + field.size(), value);
+    return static_cast<T>(value);
+}
+
+float toFloat(std::string_view field)
+{
+    float value = 0.0f;
+    std::from_chars(field.data(), field.data() + field.size(), value);
+    return value;
+}
+
+} // namespace
+
+Record parseGameRow(std::string_view line)
+{
+    if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+
+    Record rec;
+    std::string_view rest = line;
+
+    std::string_view date = nextField(rest);
+    rec.game_date_est = date.empty() ? 0 : dateToInt_2Byte(date);
+    rec.team_ID_home = toUnsigned<std::uint32_t>(nextField(rest));
+    rec.pts_home = toUnsigned<std::uint8_t>(nextField(rest));
+    rec.fg_pct_home = toFloat(nextField(rest));
+    rec.ft_pct_home = toFloat(nextField(rest));
+    rec.fg3_pct_home = toFloat(nextField(rest));
+    rec.ast_home = toUnsigned<std::uint8_t>(nextField(rest));
+    rec.reb_home = toUnsigned<std::uint8_t>(nextField(rest));
+    rec.home_team_wins = toUnsigned<std::uint8_t>(nextField(rest));
+
+    return rec;
+}
+
+void parseGameRows(std::string_view text, std::vector<Record> &out)
+{
+    while (!text.empty())
+    {
+        const char *newline = static_cast<const char *>(std::memchr(text.data(), '\n', text.size()));
+        std::size_t length = newline ? static_cast<std::size_t>(newline - text.data()) : text.size();
+
+        std::string_view line = text.substr(0, length);
+        if (!line.empty() && line != "\r")
+            out.push_back(parseGameRow(line));
+
+        text.remove_prefix(newline ? length + 1 : length);
+    }
+}
+
+TsvReader::TsvReader(const std::string &filename, std::size_t buffer_size)
+    : file{std::fopen(filename.c_str(), "rb")}, buffer(buffer_size < 4096 ? 4096 : buffer_size), begin{0}, end{0},
+      eof{false}
+{
+}
+
+TsvReader::~TsvReader()
+{
+    if (file)
+        std::fclose(file);
+}
+
+bool TsvReader::refill()
+{
+    if (eof || !file)
+        return false;
+
+    // Keep the partial line at the front, grow only if a single line outgrew the buffer
+    std::size_t pending = end - begin;
+    if (pending == buffer.size())
+        buffer.resize(buffer.size() * 2);
+    std::memmove(buffer.data(), buffer.data() + begin, pending);
+    begin = 0;
+    end = pending;
+
+    std::size_t n = std::fread(buffer.data() + end, 1, buffer.size() - end, file);
+    if (n == 0)
+        eof = true;
+    end += n;
+    return n > 0;
+}
+
+bool TsvReader::nextLine(std::string_view &line)
+{
+    while (true)
+    {
+        const char *start = buffer.data() + begin;
+        const char *newline = static_cast<const char *>(std::memchr(start, '\n', end - begin));
+        if (newline)
+        {
+            line = std::string_view(start, static_cast<std::size_t>(newline - start));
+            begin += line.size() + 1;
+            return true;
+        }
+
+        if (!refill())
+            break;
+    }
+
+    // Last line without a trailing newline
+    if (begin < end)
+    {
+        line = std::string_view(buffer.data() + begin, end - begin);
+        begin = end;
+        return true;
+    }
+    return false;
+}
+
+bool TsvReader::nextChunk(std::string_view &chunk)
+{
+    // Top the buffer up first so chunks stay close to the buffer size
+    refill();
+
+    while (true)
+    {
+        const char *start = buffer.data() + begin;
+        const char *last = static_cast<const char *>(::memrchr(start, '\n', end - begin));
+        if (last)
+        {
+            chunk = std::string_view(start, static_cast<std::size_t>(last - start) + 1);
+            begin += chunk.size();
+            return true;
+        }
+
+        if (!refill())
+            break;
+    }
+
+    if (begin < end)
+    {
+        chunk = std::string_view(buffer.data() + begin, end - begin);
+        begin = end;
+        return true;
+    }
+    return false;
+}
+
+bool TsvReader::next(Record &rec)
+{
+    std::string_view line;
+    while (nextLine(line))
+    {
+        if (line.empty() || line == "\r")
+            continue;
+        rec = parseGameRow(line);
+        return true;
+    }
+    return false;
+}
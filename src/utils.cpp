@@ -1,77 +1,109 @@
 #include "constants.h"
 #include "utils.h"
-#include <iomanip>
-#include <iostream>
-#include <sstream>
+#include <charconv>
+#include <cstdio>
+#include <fcntl.h>
 #include <string>
+#include <unistd.h>
 
-bool isLeapYear(const int year)
-{
-    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
-}
-
-std::uint16_t dateToInt_2Byte(const std::string &s)
+namespace
 {
-    std::stringstream ss(s);
-    std::string day_str, month_str, year_str;
 
-    std::getline(ss, day_str, '/');
-    std::getline(ss, month_str, '/');
-    std::getline(ss, year_str);
+// Day number of 01/01 of the epoch year; dates are stored as days since then, counting it as day 1
+constexpr int EPOCH_DAY = daysFromCivil(static_cast<int>(EPOCH_YEAR), 1, 1);
 
-    int day{std::stoi(day_str)};
-    int month{std::stoi(month_str)};
-    int year{std::stoi(year_str)};
+static_assert(civilFromDays(EPOCH_DAY).year == static_cast<int>(EPOCH_YEAR), "civilFromDays must invert daysFromCivil");
+static_assert(daysFromCivil(2000, 3, 1) - daysFromCivil(2000, 2, 28) == 2, "2000 is a leap year");
 
-    int ttlDays{};
+// "00" "01" ... "99", so each two-digit group is a single copy
+constexpr struct DigitPairs
+{
+    char chars[200];
 
-    for (int y{(int)EPOCH_YEAR}; y < year; y++)
-        ttlDays += isLeapYear(y) ? 366 : 365;
+    constexpr DigitPairs() : chars{}
+    {
+        for (int i = 0; i < 100; i++)
+        {
+            chars[2 * i] = static_cast<char>('0' + i / 10);
+            chars[2 * i + 1] = static_cast<char>('0' + i % 10);
+        }
+    }
+} DIGIT_PAIRS;
 
-    int daysInMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+char *writeTwoDigits(char *out, int value)
+{
+    out[0] = DIGIT_PAIRS.chars[2 * value];
+    out[1] = DIGIT_PAIRS.chars[2 * value + 1];
+    return out + 2;
+}
 
-    if (isLeapYear(year))
-        daysInMonth[1] = 29;
+} // namespace
 
-    for (int m = 0; m < month - 1; m++)
-        ttlDays += daysInMonth[m];
+bool isLeapYear(const int year)
+{
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
 
-    // Add remaining days
-    ttlDays += day;
+std::uint16_t dateToInt_2Byte(std::string_view s)
+{
+    // DD/MM/YYYY, parsed in place
+    int day{}, month{}, year{};
+    const char *end = s.data() + s.size();
+    const char *p = std::from_chars(s.data(), end, day).ptr;
+    p = std::from_chars(p + (p < end ? 1 : 0), end, month).ptr;
+    std::from_chars(p + (p < end ? 1 : 0), end, year);
+
+    return static_cast<std::uint16_t>(daysFromCivil(year, month, day) - EPOCH_DAY + 1);
+}
 
-    return static_cast<std::uint16_t>(ttlDays);
+char *formatDate_2Byte(std::uint16_t days_since_epoch, char *out)
+{
+    // 0 is what an empty date field is stored as, keep printing it the way it always has
+    CivilDate date = days_since_epoch == 0 ? CivilDate{static_cast<int>(EPOCH_YEAR), 1, 0}
+                                           : civilFromDays(EPOCH_DAY + days_since_epoch - 1);
+
+    out = writeTwoDigits(out, date.day);
+    *out++ = '/';
+    out = writeTwoDigits(out, date.month);
+    *out++ = '/';
+    out = writeTwoDigits(out, date.year / 100);
+    return writeTwoDigits(out, date.year % 100);
 }
 
 std::string intToDate_2Byte(std::uint16_t days_since_epoch)
 {
-    int year(EPOCH_YEAR);
-    int remainingDays(days_since_epoch);
-
-    while (true)
-    {
-        int daysInYear{isLeapYear(year) ? 366 : 365};
-
-        if (remainingDays <= daysInYear)
-            break;
-
-        remainingDays -= daysInYear;
-        year++;
-    }
-
-    int daysInMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-    if (isLeapYear(year))
-        daysInMonth[1] = 29;
+    char buffer[DATE_STRING_LENGTH];
+    formatDate_2Byte(days_since_epoch, buffer);
+    return std::string(buffer, DATE_STRING_LENGTH);
+}
 
-    int month{};
-    while (remainingDays > daysInMonth[month])
-    {
-        remainingDays -= daysInMonth[month];
-        month++;
-    }
+void datesToInt_2Byte(const std::string_view *dates, std::size_t count, std::uint16_t *out)
+{
+    for (std::size_t i = 0; i < count; i++)
+        out[i] = dates[i].empty() ? 0 : dateToInt_2Byte(dates[i]);
+}
 
-    std::stringstream ss;
-    ss << std::setfill('0') << std::setw(2) << remainingDays << '/' << std::setfill('0') << std::setw(2) << month + 1
-       << '/' << year;
+void formatDates_2Byte(const std::uint16_t *days_since_epoch, std::size_t count, char *out)
+{
+    for (std::size_t i = 0; i < count; i++)
+        out = formatDate_2Byte(days_since_epoch[i], out);
+}
 
-    return ss.str();
+bool replaceFileDurably(const std::string &temp_filename, const std::string &target_filename)
+{
+    int fd = ::open(temp_filename.c_str(), O_RDONLY);
+    bool synced = fd >= 0 && ::fsync(fd) == 0;
+    if (fd >= 0)
+        ::close(fd);
+    if (!synced || std::rename(temp_filename.c_str(), target_filename.c_str()) != 0)
+        return false;
+
+    // The rename itself lives in the directory
+    std::size_t slash = target_filename.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : target_filename.substr(0, slash);
+    int dir_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    bool dir_synced = dir_fd >= 0 && ::fsync(dir_fd) == 0;
+    if (dir_fd >= 0)
+        ::close(dir_fd);
+    return dir_synced;
 }
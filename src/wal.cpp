@@ -0,0 +1,254 @@
+#include "wal.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+namespace
+{
+
+// On disk: [crc32 u32][lsn u64][type u8][block_id u32][record_offset u16][key f32][Record]
+constexpr std::size_t LOG_ENTRY_SIZE = 4 + 8 + 1 + 4 + 2 + 4 + sizeof(Record);
+
+std::uint32_t crc32(const char *data, std::size_t length)
+{
+    static const auto table = [] {
+        std::vector<std::uint32_t> t(256);
+        for (std::uint32_t i = 0; i < 256; i++)
+        {
+            std::uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    std::uint32_t crc = 0xFFFFFFFFu;
+    for (std::size_t i = 0; i < length; i++)
+        crc = table[(crc ^ static_cast<std::uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+template <typename T> char *put(char *out, const T &value)
+{
+    std::memcpy(out, &value, sizeof(T));
+    return out + sizeof(T);
+}
+
+template <typename T> const char *get(const char *in, T &value)
+{
+    std::memcpy(&value, in, sizeof(T));
+    return in + sizeof(T);
+}
+
+void serialise(const LogRecord &record, char *out)
+{
+    char *body = out + sizeof(std::uint32_t);
+    char *p = put(body, record.lsn);
+    p = put(p, record.type);
+    p = put(p, record.ref.block_id);
+    p = put(p, record.ref.record_offset);
+    p = put(p, record.key);
+    put(p, record.record);
+
+    put(out, crc32(body, LOG_ENTRY_SIZE - sizeof(std::uint32_t)));
+}
+
+bool deserialise(const char *in, LogRecord &record)
+{
+    std::uint32_t crc;
+    const char *body = get(in, crc);
+    if (crc != crc32(body, LOG_ENTRY_SIZE - sizeof(std::uint32_t)))
+        return false;
+
+    const char *p = get(body, record.lsn);
+    p = get(p, record.type);
+    p = get(p, record.ref.block_id);
+    p = get(p, record.ref.record_offset);
+    p = get(p, record.key);
+    get(p, record.record);
+    return true;
+}
+
+bool writeAll(int fd, const char *data, std::size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = ::write(fd, data, length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;
+        data += n;
+        length -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(const std::string &filename)
+    : filename{filename}, fd{-1}, nextLsn{1}, durableLsn{0}, durableOffset{0}, flushing{false}, failed{false},
+      appends{0}, syncs{0}
+{
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    commitAll();
+    if (fd >= 0)
+        ::close(fd);
+}
+
+bool WriteAheadLog::open()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    if (fd >= 0)
+        return true;
+
+    fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Cannot open write-ahead log: " << filename << '\n';
+        return false;
+    }
+
+    // Continue numbering after the last intact record and cut off a torn tail
+    std::vector<char> entry(LOG_ENTRY_SIZE);
+    off_t offset = 0;
+    LogRecord record;
+    while (::pread(fd, entry.data(), LOG_ENTRY_SIZE, offset) == static_cast<ssize_t>(LOG_ENTRY_SIZE) &&
+           deserialise(entry.data(), record))
+    {
+        nextLsn = record.lsn + 1;
+        offset += static_cast<off_t>(LOG_ENTRY_SIZE);
+    }
+    durableLsn = nextLsn - 1;
+
+    if (::ftruncate(fd, offset) != 0 || ::lseek(fd, offset, SEEK_SET) != offset)
+    {
+        std::cerr << "Cannot position write-ahead log: " << filename << '\n';
+        return false;
+    }
+    durableOffset = offset;
+    return true;
+}
+
+std::uint64_t WriteAheadLog::append(LogRecord record)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+
+    record.lsn = nextLsn++;
+    std::size_t end = buffer.size();
+    buffer.resize(end + LOG_ENTRY_SIZE);
+    serialise(record, buffer.data() + end);
+
+    appends++;
+    return record.lsn;
+}
+
+bool WriteAheadLog::commit(std::uint64_t lsn)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (durableLsn < lsn)
+    {
+        if (flushing)
+        {
+            flushed.wait(lock);
+            continue;
+        }
+
+        if (fd < 0 || failed)
+        {
+            std::cerr << "Write-ahead log is not " << (failed ? "writable: " : "open: ") << filename << '\n';
+            return false;
+        }
+
+        // Become the leader for everything buffered so far; appends keep going meanwhile
+        flushing = true;
+        std::vector<char> batch;
+        batch.swap(buffer);
+        std::uint64_t upto = nextLsn - 1;
+        lock.unlock();
+
+        bool written = writeAll(fd, batch.data(), batch.size());
+        bool ok = written && ::fdatasync(fd) == 0;
+
+        lock.lock();
+        flushing = false;
+        if (ok)
+        {
+            durableLsn = upto;
+            durableOffset += static_cast<off_t>(batch.size());
+            syncs++;
+        }
+        else
+        {
+            // Cut the batch off so the next one follows the last durable record, and keep its records
+            // ahead of anything appended since. A failed fdatasync may already have dropped the dirty
+            // pages, so a retry would prove nothing: from then on the log refuses commits.
+            std::cerr << "Failed to " << (written ? "sync" : "write") << " write-ahead log: " << filename << '\n';
+            batch.insert(batch.end(), buffer.begin(), buffer.end());
+            buffer.swap(batch);
+            bool cut = ::ftruncate(fd, durableOffset) == 0 && ::lseek(fd, durableOffset, SEEK_SET) == durableOffset;
+            failed = written || !cut;
+        }
+        flushed.notify_all();
+
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+bool WriteAheadLog::commitAll()
+{
+    std::uint64_t last;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        last = nextLsn - 1;
+    }
+    return commit(last);
+}
+
+bool WriteAheadLog::readAll(std::vector<LogRecord> &records) const
+{
+    int in = ::open(filename.c_str(), O_RDONLY);
+    if (in < 0)
+        return false;
+
+    std::vector<char> entry(LOG_ENTRY_SIZE);
+    off_t offset = 0;
+    LogRecord record;
+    while (::pread(in, entry.data(), LOG_ENTRY_SIZE, offset) == static_cast<ssize_t>(LOG_ENTRY_SIZE) &&
+           deserialise(entry.data(), record))
+    {
+        records.push_back(record);
+        offset += static_cast<off_t>(LOG_ENTRY_SIZE);
+    }
+
+    ::close(in);
+    return true;
+}
+
+bool WriteAheadLog::truncate()
+{
+    if (!commitAll())
+        return false;
+
+    std::lock_guard<std::mutex> guard(mutex);
+    if (fd < 0)
+        return true;
+
+    // LSNs keep increasing across truncations
+    if (::ftruncate(fd, 0) != 0 || ::lseek(fd, 0, SEEK_SET) != 0 || ::fdatasync(fd) != 0)
+    {
+        std::cerr << "Cannot truncate write-ahead log: " << filename << '\n';
+        return false;
+    }
+    durableOffset = 0;
+    return true;
+}
@@ -0,0 +1,163 @@
+#include "zone_map.h"
+#include "page.h"
+#include "utils.h"
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+
+constexpr std::uint32_t ZONE_MAP_MAGIC = 0x5A4D4150; // "ZMAP"
+
+} // namespace
+
+void ZoneMap::reset()
+{
+    zones.clear();
+}
+
+void ZoneMap::recomputeColumn(std::uint32_t block_id, const Block &block, RecordField field)
+{
+    ColumnZone &zone = zones[block_id].columns[static_cast<std::size_t>(field)];
+    zone = ColumnZone{};
+
+    bool first = true;
+    forEachLiveSlot(block, [&](std::size_t slot) {
+        double value = readFieldAsDouble(block, field, slot);
+        if (first || value < zone.min)
+            zone.min = value;
+        if (first || value > zone.max)
+            zone.max = value;
+        if (value == 0)
+            zone.zero_count++;
+        first = false;
+    });
+}
+
+void ZoneMap::rebuildBlock(std::uint32_t block_id, const Block &block)
+{
+    if (block_id >= zones.size())
+        zones.resize(static_cast<std::size_t>(block_id) + 1);
+
+    zones[block_id].live_count = pageHeader(block)->live_count;
+    for (std::size_t f = 0; f < RECORD_FIELD_COUNT; f++)
+        recomputeColumn(block_id, block, static_cast<RecordField>(f));
+}
+
+void ZoneMap::removeSlot(std::uint32_t block_id, const Block &block, std::size_t slot)
+{
+    if (block_id >= zones.size())
+        return;
+
+    BlockZone &zone = zones[block_id];
+    zone.live_count = pageHeader(block)->live_count;
+
+    // Only a column whose bound just left needs another pass over the block
+    for (std::size_t f = 0; f < RECORD_FIELD_COUNT; f++)
+    {
+        RecordField field = static_cast<RecordField>(f);
+        ColumnZone &column = zone.columns[f];
+        double value = readFieldAsDouble(block, field, slot);
+
+        if (value == column.min || value == column.max)
+            recomputeColumn(block_id, block, field);
+        else if (value == 0 && column.zero_count > 0)
+            column.zero_count--;
+    }
+}
+
+bool ZoneMap::mayMatch(std::uint32_t block_id, const ScanPredicate &predicate) const
+{
+    if (block_id >= zones.size())
+        return true; // unknown block, it has to be read
+
+    const BlockZone &zone = zones[block_id];
+    if (zone.live_count == 0)
+        return false;
+
+    const ColumnZone &column = zone.columns[static_cast<std::size_t>(predicate.field)];
+    double value = predicate.value;
+    double high = predicate.high;
+    if (isFloatField(predicate.field))
+    {
+        // Compare the way the scan kernels do
+        value = static_cast<float>(value);
+        high = static_cast<float>(high);
+    }
+
+    switch (predicate.op)
+    {
+    case CompareOp::LT:
+        return column.min < value;
+    case CompareOp::LE:
+        return column.min <= value;
+    case CompareOp::GT:
+        return column.max > value;
+    case CompareOp::GE:
+        return column.max >= value;
+    case CompareOp::EQ:
+        if (value == 0)
+            return column.zero_count > 0;
+        return column.min <= value && value <= column.max;
+    case CompareOp::BETWEEN:
+        return column.max >= value && column.min <= high;
+    }
+    return true;
+}
+
+const BlockZone *ZoneMap::getZone(std::uint32_t block_id) const
+{
+    return block_id < zones.size() ? &zones[block_id] : nullptr;
+}
+
+bool ZoneMap::save(const std::string &filename) const
+{
+    // A clean catalog vouches for this file, so it is replaced whole or not at all
+    std::string temp_filename = filename + ".tmp";
+    std::ofstream file(temp_filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Cannot write zone map: " << temp_filename << '\n';
+        return false;
+    }
+
+    std::uint32_t count = static_cast<std::uint32_t>(zones.size());
+    file.write(reinterpret_cast<const char *>(&ZONE_MAP_MAGIC), sizeof(ZONE_MAP_MAGIC));
+    file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    file.write(reinterpret_cast<const char *>(zones.data()), static_cast<std::streamsize>(count * sizeof(BlockZone)));
+    file.close();
+    if (!file || !replaceFileDurably(temp_filename, filename))
+    {
+        std::cerr << "Cannot replace zone map: " << filename << '\n';
+        return false;
+    }
+    return true;
+}
+
+bool ZoneMap::load(const std::string &filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    std::uint32_t magic = 0;
+    std::uint32_t count = 0;
+    file.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+    file.read(reinterpret_cast<char *>(&count), sizeof(count));
+    if (!file || magic != ZONE_MAP_MAGIC)
+    {
+        std::cerr << "Not a zone map file: " << filename << '\n';
+        return false;
+    }
+
+    std::vector<BlockZone> loaded(count);
+    file.read(reinterpret_cast<char *>(loaded.data()), static_cast<std::streamsize>(count * sizeof(BlockZone)));
+    if (!file)
+    {
+        std::cerr << "Truncated zone map file: " << filename << '\n';
+        return false;
+    }
+
+    zones = std::move(loaded);
+    return true;
+}